@@ -1,27 +1,125 @@
 #include "AsyncRequests.h"
+#include "Utility.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 AsyncRequests* AsyncRequests::self{ nullptr };
+std::atomic<RequestId> AsyncRequests::NextId{ 1 };
 
-AsyncRequests::AsyncRequests() {
+AsyncRequests::AsyncRequests( const Options& options ) : Settings( options ), Submitted( options.QueueCapacity ) {
 	if ( MultiHandle )
 		return;
+	Duplicates.SetWindow( std::chrono::milliseconds( Settings.DedupWindowMs ) );
 	MultiHandle = curl_multi_init();
+	if ( MultiHandle ) {
+		curl_multi_setopt( MultiHandle, CURLMOPT_MAXCONNECTS, Settings.MaxCachedConnections );
+		curl_multi_setopt( MultiHandle, CURLMOPT_MAX_HOST_CONNECTIONS, Settings.MaxConnectionsPerHost );
+		if ( Settings.Multiplex ) {
+			curl_multi_setopt( MultiHandle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX );
+			curl_multi_setopt( MultiHandle, CURLMOPT_MAX_CONCURRENT_STREAMS, Settings.MaxStreamsPerConnection );
+		}
+	}
+
+	// Every easy handle lives on the thread driving MultiHandle, so the share needs no lock callbacks
+	if ( MultiHandle && Settings.ShareCaches ) {
+		ShareHandle = curl_share_init();
+		if ( ShareHandle ) {
+			curl_share_setopt( ShareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS );
+			curl_share_setopt( ShareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION );
+			curl_share_setopt( ShareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT );
+		}
+	}
+
+	if ( MultiHandle && Settings.EventDriven ) {
+		Events = new SocketEvents( MultiHandle, &RunningHandles );
+		if ( !Events->Valid() ) { // No wakeup channel, stay with curl_multi_perform
+			delete Events;
+			Events = nullptr;
+		}
+	}
+
+	std::vector<Request*> unsent;
+	if ( MultiHandle && !Settings.SpoolPath.empty() && Journal.Open( Settings.SpoolPath, std::chrono::milliseconds( Settings.SpoolSyncMs ), unsent ) ) {
+		if ( !unsent.empty() ) { // Rate limits apply to the replay as well
+			telegramNotf_ = new TelegramNotifications();
+			telegramNotf_->SetCoalesceWindow( std::chrono::milliseconds( Settings.CoalesceWindowMs ) );
+			discordNotf_ = new DiscordNotifications();
+			discordNotf_->SetCoalesceWindow( std::chrono::milliseconds( Settings.CoalesceWindowMs ) );
+		}
+		for ( Request* request : unsent ) {
+			request->Id = ReserveId();
+			request->SubmittedAt = Clock::now();
+			Journal.Record( *request ); // Again, under the new id, in the new journal
+			Waiting[static_cast<size_t>( request->Priority )].push_back( request ); // Past Submitted, the overflow policy must not drop a replay
+		}
+		Backlog = WaitingCount();
+		Journal.Commit();
+	} else {
+		for ( Request* request : unsent )
+			delete request;
+	}
+
+	if ( MultiHandle && Settings.Threaded )
+		Worker = std::thread( &AsyncRequests::WorkerLoop, this );
 }
 
 AsyncRequests::~AsyncRequests() {
-	if ( !MultiHandle )
-		return;
-	curl_multi_cleanup( MultiHandle );
+	if ( Worker.joinable() ) {
+		StopWorker = true;
+		Wake();
+		Worker.join();
+	}
+
+	for ( Request* request : Active ) {
+		curl_multi_remove_handle( MultiHandle, request->Handle );
+		delete request;
+	}
+	Active.clear();
+	Request* request{ nullptr };
+	while ( Submitted.TryPop( request ) )
+		delete request;
+	for ( std::deque<Request*>& waiting : Waiting ) {
+		for ( Request* queued : waiting )
+			delete queued;
+		waiting.clear();
+	}
+	Deferred.ForEach( []( Request* deferred ) { delete deferred; } );
+
+	for ( CURL* handle : IdleHandles )
+		curl_easy_cleanup( handle );
+	IdleHandles.clear();
+
+	delete telegramNotf_;
+	delete discordNotf_;
+
+	delete Events; // Before the cleanup, which unhooks nothing by itself
+	if ( MultiHandle )
+		curl_multi_cleanup( MultiHandle );
+	if ( ShareHandle )
+		curl_share_cleanup( ShareHandle ); // Only valid once no easy handle references it
 }
 
 void AsyncRequests::Initialize() {
+	Initialize( Options() );
+}
+
+void AsyncRequests::Initialize( const Options& options ) {
 	if ( !self )
-		self = new AsyncRequests();
+		self = new AsyncRequests( options );
+}
+
+void AsyncRequests::Configure( const Options& options ) {
+	UnInitialize();
+	Initialize( options );
 }
 
 DiscordNotifications* AsyncRequests::Discord() {
 	if ( self->MultiHandle != nullptr ) {
-		if ( !self->discordNotf_ ) self->discordNotf_ = new DiscordNotifications( self->MultiHandle );
+		if ( !self->discordNotf_ ) {
+			self->discordNotf_ = new DiscordNotifications();
+			self->discordNotf_->SetCoalesceWindow( std::chrono::milliseconds( self->Settings.CoalesceWindowMs ) );
+		}
 		return self->discordNotf_;
 	}
 	return nullptr;
@@ -29,15 +127,131 @@ DiscordNotifications* AsyncRequests::Discord() {
 
 TelegramNotifications* AsyncRequests::Telegram() {
 	if ( self->MultiHandle != nullptr ) {
-		if ( !self->telegramNotf_ ) self->telegramNotf_ = new TelegramNotifications( self->MultiHandle );
+		if ( !self->telegramNotf_ ) {
+			self->telegramNotf_ = new TelegramNotifications();
+			self->telegramNotf_->SetCoalesceWindow( std::chrono::milliseconds( self->Settings.CoalesceWindowMs ) );
+		}
 		return self->telegramNotf_;
 	}
 	return nullptr;
 }
 
+RequestId AsyncRequests::ReserveId() {
+	RequestId id = NextId++;
+	return id != 0 ? id : NextId++; // Skip 0 on wrap-around
+}
+
+RequestId AsyncRequests::Deduplicate( Request* request, size_t limit ) {
+	if ( !Deduplicating() )
+		return 0;
+	return self->Duplicates.Add( request, limit, Clock::now() );
+}
+
+bool AsyncRequests::Deduplicating() {
+	return self && self->MultiHandle && self->Duplicates.Enabled();
+}
+
+RequestId AsyncRequests::Submit( Request* request ) {
+	if ( !self ) {
+		delete request;
+		return 0;
+	}
+	if ( !self->MultiHandle || self->Draining ) {
+		self->Reject( request );
+		return 0;
+	}
+	RequestId id = self->Enqueue( request );
+	if ( self->Settings.Threaded )
+		self->Wake();
+	return id;
+}
+
+std::vector<RequestId> AsyncRequests::Submit( const std::vector<Request*>& requests ) {
+	std::vector<RequestId> ids( requests.size(), 0 );
+	if ( !self ) {
+		for ( Request* request : requests )
+			delete request;
+		return ids;
+	}
+	if ( !self->MultiHandle || self->Draining ) {
+		for ( Request* request : requests )
+			self->Reject( request );
+		return ids;
+	}
+	for ( size_t i = 0; i < requests.size(); ++i )
+		ids[i] = self->Enqueue( requests[i] );
+	if ( self->Settings.Threaded )
+		self->Wake(); // One wakeup for the whole batch
+	return ids;
+}
+
 void AsyncRequests::MultiPerform() {
-	if ( self->MultiHandle )
-		curl_multi_perform( self->MultiHandle, &self->RunningHandles );
+	if ( !self || !self->MultiHandle )
+		return;
+	Clock::time_point now = Clock::now(); // Coalescing and dedup windows live on the game thread in both modes
+	self->Duplicates.Flush( now );
+	if ( self->telegramNotf_ )
+		self->telegramNotf_->FlushCoalesced( now );
+	if ( self->discordNotf_ )
+		self->discordNotf_->FlushCoalesced( now );
+	if ( !self->Settings.Threaded )
+		self->Tick( 0 );
+}
+
+void AsyncRequests::TakeCompleted( std::vector<Completion>& completions ) {
+	completions.clear();
+	if ( !self )
+		return;
+	std::unique_lock<std::mutex> lock( self->FinishedLock, std::try_to_lock );
+	if ( lock.owns_lock() ) // Never stall the frame on the worker, try again next tick
+		completions.swap( self->Finished );
+}
+
+size_t AsyncRequests::QueueDepth() {
+	if ( !self )
+		return 0;
+	return self->Queued.load( std::memory_order_relaxed ) + self->Backlog.load( std::memory_order_relaxed );
+}
+
+size_t AsyncRequests::InFlight() {
+	return self ? self->Running.load( std::memory_order_relaxed ) : 0;
+}
+
+AsyncRequests::DrainReport AsyncRequests::Drain( long timeoutMs ) {
+	DrainReport report;
+	if ( !self || !self->MultiHandle )
+		return report;
+	Clock::time_point now = Clock::now();
+	Clock::time_point deadline = now + std::chrono::milliseconds( std::max( 0l, timeoutMs ) );
+
+	// Texts held back by the windows are the last work accepted; those a full queue refuses never go out
+	size_t refused = 0;
+	if ( self->telegramNotf_ )
+		refused += self->telegramNotf_->FlushCoalesced( now, true );
+	if ( self->discordNotf_ )
+		refused += self->discordNotf_->FlushCoalesced( now, true );
+	refused += self->Duplicates.Flush( now, true );
+	self->Draining = true;
+
+	if ( self->Worker.joinable() ) { // The game thread drives what is left
+		self->StopWorker = true;
+		self->Wake();
+		self->Worker.join();
+	}
+
+	size_t outstanding = self->Outstanding();
+	while ( self->Outstanding() != 0 ) {
+		now = Clock::now();
+		if ( now >= deadline )
+			break;
+		if ( self->Outstanding() == self->Deferred.Size() && self->Deferred.NextDeadline() >= deadline )
+			break; // Only rate-limited requests are left and none may start in time
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>( deadline - now ).count();
+		self->Tick( static_cast<int>( std::clamp<long long>( remaining, 1, 100 ) ) );
+	}
+	report.Flushed = outstanding - self->Outstanding();
+	report.Abandoned = self->Outstanding() + refused;
+	return report;
 }
 
 void AsyncRequests::UnInitialize() {
@@ -45,4 +259,403 @@ void AsyncRequests::UnInitialize() {
 		delete self;
 		self = nullptr;
 	}
+}
+
+RequestId AsyncRequests::Enqueue( Request* request ) {
+	if ( request->Id == 0 )
+		request->Id = ReserveId();
+	RequestId id = request->Id;
+	request->SubmittedAt = std::chrono::steady_clock::now();
+	++Queued; // Before the push, so the consumer never takes it below zero
+	Journal.Record( *request ); // Before the push too, its tombstone may follow at once
+	while ( !Submitted.TryPush( request ) ) {
+		switch ( Settings.Overflow ) {
+			case ( eOverflowPolicy::DROP_OLDEST ): {
+				Request* oldest{ nullptr };
+				if ( Submitted.TryPop( oldest ) ) {
+					--Queued;
+					Finish( oldest, true );
+					++Dropped;
+				}
+				break;
+			}
+			case ( eOverflowPolicy::DROP_NEWEST ): {
+				--Queued;
+				Finish( request, true ); // A reserved id was handed out already, its awaiters must hear of the drop
+				++Dropped;
+				return 0;
+			}
+			case ( eOverflowPolicy::BLOCK ): {
+				if ( Settings.Threaded ) {
+					Wake();
+					std::this_thread::yield();
+				} else {
+					Tick( 1 ); // We are the consumer, drive transfers until there is room
+				}
+				break;
+			}
+		}
+	}
+	return id;
+}
+
+void AsyncRequests::Tick( int pollTimeoutMs ) {
+	StartDeferred();
+	StartSubmitted();
+	if ( Events )
+		Events->Run( 0 ); // Only the sockets that are ready, and curl's timer if it expired
+	else
+		curl_multi_perform( MultiHandle, &RunningHandles );
+	HarvestCompleted();
+	StartWaiting(); // Transfers held by the caps can take the slots just freed
+
+	Backlog.store( Deferred.Size() + WaitingCount(), std::memory_order_relaxed );
+	Journal.Sync( Clock::now() );
+	if ( pollTimeoutMs > 0 ) {
+		if ( Events )
+			Events->Run( PollTimeout( pollTimeoutMs ) );
+		else
+			curl_multi_poll( MultiHandle, nullptr, 0, PollTimeout( pollTimeoutMs ), nullptr );
+	}
+}
+
+void AsyncRequests::WorkerLoop() {
+	while ( !StopWorker )
+		Tick( 1000 );
+}
+
+void AsyncRequests::Wake() {
+	if ( Events )
+		Events->Wakeup();
+	else
+		curl_multi_wakeup( MultiHandle );
+}
+
+size_t AsyncRequests::Outstanding() const {
+	return Queued + Active.size() + Deferred.Size() + WaitingCount();
+}
+
+size_t AsyncRequests::WaitingCount() const {
+	size_t count = 0;
+	for ( const std::deque<Request*>& waiting : Waiting )
+		count += waiting.size();
+	return count;
+}
+
+void AsyncRequests::StartSubmitted() {
+	// Once caps and rate limits hold back a full queue's worth, the rest stay in Submitted, where the overflow policy applies
+	Request* request{ nullptr };
+	while ( WaitingCount() + Deferred.Size() < Submitted.Capacity() && Submitted.TryPop( request ) ) {
+		--Queued;
+		Waiting[static_cast<size_t>( request->Priority )].push_back( request );
+	}
+	StartWaiting();
+}
+
+void AsyncRequests::StartDeferred() {
+	Deferred.Advance( Clock::now(), Due );
+	for ( Request* request : Due )
+		Waiting[static_cast<size_t>( request->Priority )].push_back( request ); // Competes with fresh submissions by class
+	Due.clear();
+}
+
+void AsyncRequests::StartWaiting() {
+	// Classes are admitted strictly in order, so a queued alert takes rate-limit tokens before any bulk send
+	Clock::time_point now = Clock::now();
+	for ( std::deque<Request*>& waiting : Waiting ) {
+		while ( !waiting.empty() ) {
+			Request* request = waiting.front();
+			if ( Capped( request->Priority ) )
+				break; // Lower classes are capped at least as tightly, so they wait too
+			waiting.pop_front();
+			Admit( request, now ); // May be deferred again, behind requests for the same destination
+		}
+	}
+}
+
+bool AsyncRequests::Capped( ePriority priority ) const {
+	size_t headroom = priority == ePriority::HIGH ? HIGH_PRIORITY_HEADROOM : 0;
+	if ( Settings.MaxInFlight != 0 && Active.size() >= Settings.MaxInFlight + headroom )
+		return true;
+	return priority == ePriority::LOW && Settings.MaxLowPriorityTransfers != 0 && ActiveLowPriority >= Settings.MaxLowPriorityTransfers;
+}
+
+void AsyncRequests::Admit( Request* request, Clock::time_point now ) {
+	if ( Capped( request->Priority ) ) {
+		Waiting[static_cast<size_t>( request->Priority )].push_back( request ); // A follow-up chunk while the caps are full
+		return;
+	}
+	Clock::duration wait = Clock::duration::zero();
+	if ( request->Provider == eProvider::TELEGRAM && telegramNotf_ )
+		wait = telegramNotf_->Admit( *request, now );
+	else if ( request->Provider == eProvider::DISCORD && discordNotf_ )
+		wait = discordNotf_->Admit( *request, now );
+	if ( wait > Clock::duration::zero() )
+		Defer( request, now + wait );
+	else
+		Start( request );
+}
+
+void AsyncRequests::Defer( Request* request, Clock::time_point when ) {
+	Deferred.Schedule( request, when ); // Equal deadlines keep submission order
+}
+
+int AsyncRequests::PollTimeout( int maximumMs ) {
+	// Sleep until whichever comes first: curl's own timers (connect and transfer timeouts, HTTP/2 housekeeping) or ours
+	long curlTimeoutMs = -1;
+	curl_multi_timeout( MultiHandle, &curlTimeoutMs );
+	long long timeoutMs = curlTimeoutMs >= 0 ? std::min<long long>( curlTimeoutMs, maximumMs ) : maximumMs;
+	if ( !Deferred.Empty() ) {
+		auto untilNext = std::chrono::ceil<std::chrono::milliseconds>( Deferred.NextDeadline() - Clock::now() ).count(); // Rounded up so we never wake just short of it
+		timeoutMs = std::min<long long>( timeoutMs, untilNext );
+	}
+	return static_cast<int>( std::clamp<long long>( timeoutMs, 0, maximumMs ) );
+}
+
+void AsyncRequests::Start( Request* request ) {
+#pragma warning( push )
+#pragma warning( disable : 26812)
+
+	CURL* cURL = request->Handle = AcquireHandle();
+	if ( !cURL ) {
+		request->Result = CURLE_FAILED_INIT;
+		Finish( request, false );
+		return;
+	}
+	++request->Attempts;
+
+	curl_easy_setopt( cURL, CURLOPT_POST, 1 ); // Request Method
+	curl_easy_setopt( cURL, CURLOPT_URL, request->CString( request->URL ) ); // Request URL
+	curl_easy_setopt( cURL, CURLOPT_DEFAULT_PROTOCOL, "https" ); // Request Protocol
+	curl_easy_setopt( cURL, CURLOPT_NOSIGNAL, 1L ); // Required when driven from a non-main thread
+	curl_easy_setopt( cURL, CURLOPT_TCP_KEEPALIVE, 1L ); // Keep idle cached connections warm
+	curl_easy_setopt( cURL, CURLOPT_DNS_CACHE_TIMEOUT, Settings.DNSCacheTimeout );
+	curl_easy_setopt( cURL, CURLOPT_CONNECTTIMEOUT_MS, Settings.ConnectTimeoutMs );
+	curl_easy_setopt( cURL, CURLOPT_TIMEOUT_MS, Settings.TransferTimeoutMs );
+	if ( ShareHandle )
+		curl_easy_setopt( cURL, CURLOPT_SHARE, ShareHandle ); // Reapplied every time, curl_easy_reset clears it
+	if ( Settings.Multiplex ) {
+		curl_easy_setopt( cURL, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS );
+		curl_easy_setopt( cURL, CURLOPT_PIPEWAIT, 1L ); // Wait for a multiplexable connection rather than opening another
+		static constexpr long STREAM_WEIGHTS[PRIORITY_CLASSES] = { 256, 16, 1 }; // 16 is HTTP/2's default
+		curl_easy_setopt( cURL, CURLOPT_STREAM_WEIGHT, STREAM_WEIGHTS[static_cast<size_t>( request->Priority )] );
+	}
+
+	request->MIME = curl_mime_init( cURL ); // Initialize MultipurposeInternetMailExtensions
+	for ( size_t i = 0; i < request->FieldCount; ++i ) {
+		const Request::Field& field = request->Fields[i];
+		curl_mimepart* MIMEPart = curl_mime_addpart( request->MIME );
+		curl_mime_name( MIMEPart, request->CString( field.Name ) );
+		if ( field.MIMEType.Length == 0 ) {
+			Request::Body& body = request->Bodies[i] = { request->CString( field.Data ), field.Data.Length, 0 };
+			curl_mime_data_cb( MIMEPart, static_cast<curl_off_t>( body.Size ), &AsyncRequests::ReadBody, &AsyncRequests::SeekBody, nullptr, &body ); // Streamed from the arena, not copied
+		} else {
+			curl_mime_filedata( MIMEPart, request->CString( field.Data ) );
+			curl_mime_type( MIMEPart, request->CString( field.MIMEType ) );
+		}
+	}
+	curl_easy_setopt( cURL, CURLOPT_MIMEPOST, request->MIME ); // Install MIME
+
+	curl_easy_setopt( cURL, CURLOPT_PRIVATE, request ); // Back-reference for the completion stage
+	curl_easy_setopt( cURL, CURLOPT_WRITEFUNCTION, &AsyncRequests::WriteResponse );
+	curl_easy_setopt( cURL, CURLOPT_WRITEDATA, request );
+	if ( request->Provider == eProvider::DISCORD ) { // Rate-limit state arrives in the headers
+		curl_easy_setopt( cURL, CURLOPT_HEADERFUNCTION, &AsyncRequests::WriteHeader );
+		curl_easy_setopt( cURL, CURLOPT_HEADERDATA, request );
+	}
+
+	if ( curl_multi_add_handle( MultiHandle, cURL ) != CURLM_OK ) {
+		request->Result = CURLE_FAILED_INIT;
+		Finish( request, false ); // Frees the handle along with the request
+		return;
+	}
+	request->ActiveIndex = Active.size();
+	Active.push_back( request );
+	Running.store( Active.size(), std::memory_order_relaxed );
+	if ( request->Priority == ePriority::LOW )
+		++ActiveLowPriority;
+
+#pragma warning( pop )
+}
+
+void AsyncRequests::HarvestCompleted() {
+	int messagesLeft = 0;
+	while ( CURLMsg* message = curl_multi_info_read( MultiHandle, &messagesLeft ) ) {
+		if ( message->msg != CURLMSG_DONE )
+			continue;
+		Request* request{ nullptr };
+		curl_easy_getinfo( message->easy_handle, CURLINFO_PRIVATE, &request );
+		if ( request )
+			Complete( request, message->data.result );
+	}
+}
+
+void AsyncRequests::Complete( Request* request, CURLcode result ) {
+	request->Result = result;
+	curl_easy_getinfo( request->Handle, CURLINFO_RESPONSE_CODE, &request->ResponseCode );
+	bool delivered = result == CURLE_OK && request->ResponseCode >= 200 && request->ResponseCode < 300;
+
+	curl_multi_remove_handle( MultiHandle, request->Handle );
+
+	// Swap-remove from the active list so the cost stays O(1) per completion
+	Request* last = Active.back();
+	Active[request->ActiveIndex] = last;
+	last->ActiveIndex = request->ActiveIndex;
+	Active.pop_back();
+	Running.store( Active.size(), std::memory_order_relaxed );
+	if ( request->Priority == ePriority::LOW )
+		--ActiveLowPriority;
+
+	curl_mime_free( request->MIME );
+	request->MIME = nullptr;
+	ReleaseHandle( request->Handle );
+	request->Handle = nullptr;
+
+	Clock::time_point now = Clock::now();
+	Clock::duration retryAfter = Clock::duration::zero();
+	if ( request->Provider == eProvider::TELEGRAM && telegramNotf_ )
+		retryAfter = telegramNotf_->RetryAfter( *request, now );
+	else if ( request->Provider == eProvider::DISCORD && discordNotf_ )
+		retryAfter = discordNotf_->RetryAfter( *request, now );
+	bool rateLimited = retryAfter > Clock::duration::zero(); // Defer instead of dropping
+	bool transient = !rateLimited && !delivered && ShouldRetry( *request );
+	if ( rateLimited || transient ) {
+		request->Response.clear();
+		request->ResponseHeaders.clear();
+		request->ResponseCode = 0;
+		request->Result = CURLE_OK;
+		request->Admitted = false; // The next attempt takes a new rate-limit slot
+		if ( rateLimited )
+			Defer( request, now + retryAfter );
+		else
+			Defer( request, now + Backoff( request->Attempts ) );
+		return;
+	}
+	if ( delivered )
+		++Succeeded;
+	else
+		++Failed;
+	if ( request->Next && delivered ) {
+		// Delivered part of a split message: the next part goes out under the same id, in order
+		Request* next = request->Next;
+		request->Next = nullptr;
+		next->Id = request->Id;
+		next->SubmittedAt = request->SubmittedAt;
+		delete request;
+		Admit( next, now );
+		return;
+	}
+
+	Finish( request, false );
+}
+
+void AsyncRequests::Finish( Request* request, bool dropped ) {
+	Completion completion;
+	completion.Id = request->Id;
+	completion.Result = request->Result;
+	completion.ResponseCode = request->ResponseCode;
+	completion.LatencyMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - request->SubmittedAt ).count();
+	completion.MessageId = Utility::FindJSONInteger( request->Response, "message_id" );
+	completion.Dropped = dropped;
+	{
+		std::lock_guard<std::mutex> lock( FinishedLock );
+		Finished.push_back( completion );
+	}
+	Journal.Complete( request->Id ); // Delivered, rejected or dropped: nothing to replay
+	delete request;
+}
+
+void AsyncRequests::Reject( Request* request ) {
+	if ( request->Id != 0 ) { // Reserved by the coalescer or the duplicate filter and already handed to the script
+		request->SubmittedAt = std::chrono::steady_clock::now();
+		Finish( request, true );
+	} else {
+		delete request;
+	}
+}
+
+bool AsyncRequests::ShouldRetry( const Request& request ) const {
+	unsigned maxAttempts = 1;
+	if ( request.Provider == eProvider::TELEGRAM )
+		maxAttempts = Settings.TelegramMaxAttempts;
+	else if ( request.Provider == eProvider::DISCORD )
+		maxAttempts = Settings.DiscordMaxAttempts;
+	if ( request.Attempts >= maxAttempts )
+		return false;
+
+	switch ( request.Result ) {
+		case ( CURLE_OK ): {
+			return request.ResponseCode >= 500; // The server failed, the request itself was fine
+		}
+		case ( CURLE_COULDNT_RESOLVE_HOST ):
+		case ( CURLE_COULDNT_CONNECT ):
+		case ( CURLE_OPERATION_TIMEDOUT ):
+		case ( CURLE_SSL_CONNECT_ERROR ):
+		case ( CURLE_SEND_ERROR ):
+		case ( CURLE_RECV_ERROR ):
+		case ( CURLE_GOT_NOTHING ):
+		case ( CURLE_PARTIAL_FILE ):
+		case ( CURLE_HTTP2 ):
+		case ( CURLE_HTTP2_STREAM ): {
+			return true; // Network trouble, worth another try
+		}
+		default: {
+			return false;
+		}
+	}
+}
+
+AsyncRequests::Clock::duration AsyncRequests::Backoff( unsigned attempts ) {
+	// Exponential with "equal jitter": half the step is fixed, the other half random, so retries spread out but keep growing
+	long long step = Settings.RetryBaseMs;
+	for ( unsigned i = 1; i < attempts && step < Settings.RetryMaxMs; ++i )
+		step *= 2;
+	step = std::min<long long>( step, Settings.RetryMaxMs );
+	std::uniform_int_distribution<long long> random( 0, step / 2 );
+	return std::chrono::milliseconds( step - step / 2 + random( Jitter ) );
+}
+
+CURL* AsyncRequests::AcquireHandle() {
+	if ( IdleHandles.empty() )
+		return curl_easy_init();
+	CURL* handle = IdleHandles.back();
+	IdleHandles.pop_back();
+	return handle;
+}
+
+void AsyncRequests::ReleaseHandle( CURL* handle ) {
+	if ( IdleHandles.size() >= Settings.HandlePoolSize ) {
+		curl_easy_cleanup( handle );
+		return;
+	}
+	curl_easy_reset( handle ); // Drops per-request options, keeps DNS and session caches
+	IdleHandles.push_back( handle );
+}
+
+size_t AsyncRequests::WriteResponse( char* data, size_t size, size_t count, void* userdata ) {
+	auto request = static_cast<Request*>( userdata );
+	request->Response.append( data, size * count );
+	return size * count;
+}
+
+size_t AsyncRequests::ReadBody( char* buffer, size_t size, size_t count, void* userdata ) {
+	auto body = static_cast<Request::Body*>( userdata );
+	size_t length = std::min( size * count, body->Size - body->Position );
+	memcpy( buffer, body->Data + body->Position, length );
+	body->Position += length;
+	return length;
+}
+
+int AsyncRequests::SeekBody( void* userdata, curl_off_t offset, int origin ) {
+	auto body = static_cast<Request::Body*>( userdata );
+	if ( origin != SEEK_SET || offset < 0 || static_cast<size_t>( offset ) > body->Size )
+		return CURL_SEEKFUNC_FAIL;
+	body->Position = static_cast<size_t>( offset ); // Rewound when curl resends, e.g. after a redirect
+	return CURL_SEEKFUNC_OK;
+}
+
+size_t AsyncRequests::WriteHeader( char* data, size_t size, size_t count, void* userdata ) {
+	auto request = static_cast<Request*>( userdata );
+	request->ResponseHeaders.append( data, size * count );
+	return size * count;
 }
\ No newline at end of file
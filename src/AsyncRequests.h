@@ -2,30 +2,164 @@
 #define _ASYNC_REQUESTS_H_
 
 #include <curl/curl.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DuplicateFilter.h"
+#include "Request.h"
+#include "SocketEvents.h"
+#include "Spool.h"
+#include "TimerWheel.h"
+#include "SubmissionQueue.h"
 #include "DiscordNotifications.h"
 #include "TelegramNotifications.h"
 
 class AsyncRequests
 {
+	using Clock = std::chrono::steady_clock;
+public:
+	enum class eOverflowPolicy
+	{
+		DROP_OLDEST = 0,
+		DROP_NEWEST = 1,
+		BLOCK = 2
+	}; // enum class eOverflowPolicy
+	struct Options
+	{
+		bool Threaded = false; // Drive curl from a background thread instead of the game loop
+		size_t QueueCapacity = 1024; // Rounded up to a power of two
+		eOverflowPolicy Overflow = eOverflowPolicy::DROP_OLDEST;
+		size_t HandlePoolSize = 16; // Idle easy handles kept for reuse
+		long MaxCachedConnections = 16; // Keep-alive connections held by MultiHandle
+		bool Multiplex = false; // Share one HTTP/2 connection between concurrent requests to a host
+		long MaxStreamsPerConnection = 100;
+		long MaxConnectionsPerHost = 0; // 0 means unlimited
+		bool ShareCaches = true; // One DNS, TLS session and connection cache for every provider
+		long DNSCacheTimeout = 3600; // Seconds
+		long CoalesceWindowMs = 0; // Join texts to the same destination sent within this window, 0 disables
+		long DedupWindowMs = 0; // Collapse identical texts to the same destination within this window, 0 disables
+		size_t MaxLowPriorityTransfers = 2; // Concurrent ePriority::LOW transfers, 0 means unlimited
+		size_t MaxInFlight = 64; // Transfers attached to MultiHandle, 0 means unlimited; ePriority::HIGH may exceed it by HIGH_PRIORITY_HEADROOM
+		std::string SpoolPath; // Journal that keeps unsent requests across UnLoad and restarts, empty disables
+		long SpoolSyncMs = 1000; // Longest a journal record waits for the disk sync
+		unsigned TelegramMaxAttempts = 4; // Tries before a transient failure is reported, 1 disables retries
+		unsigned DiscordMaxAttempts = 4;
+		long RetryBaseMs = 500; // Backoff before the second attempt, doubled for every further one
+		long RetryMaxMs = 30000;
+		long ConnectTimeoutMs = 10000;
+		long TransferTimeoutMs = 0; // Whole transfer, 0 means none; uploads can take long
+		bool EventDriven = false; // Only touch sockets that became ready (curl_multi_socket_action) instead of every transfer each tick; see SocketEvents for a WSAPoll caveat
+	}; // struct Options
+	struct DrainReport
+	{
+		size_t Flushed = 0; // Finished while draining, delivered or not
+		size_t Abandoned = 0; // Still queued or in flight at the deadline, or refused by a full queue
+	}; // struct DrainReport
+private:
 	static AsyncRequests* self;
 
+	Options Settings;
+
 	CURLM* MultiHandle{ nullptr };
+	CURLSH* ShareHandle{ nullptr };
 	int RunningHandles = 0;
+	SocketEvents* Events{ nullptr }; // Set in event-driven mode
+
+	SubmissionQueue<Request*> Submitted; // Handed over by the notifiers, not yet started
+	std::atomic<size_t> Dropped{ 0 };
+	std::atomic<size_t> Queued{ 0 }; // In Submitted
+	std::atomic<size_t> Backlog{ 0 }; // In Waiting and Deferred, published by the thread driving MultiHandle
+	std::atomic<size_t> Running{ 0 }; // Active.size(), published for other threads
+	DuplicateFilter Duplicates; // Game thread only
+	Spool Journal;
+
+	static constexpr size_t PRIORITY_CLASSES = 3;
+	static constexpr size_t HIGH_PRIORITY_HEADROOM = 8; // Transfers only ePriority::HIGH may attach beyond MaxInFlight
+	std::deque<Request*> Waiting[PRIORITY_CLASSES]; // Taken off Submitted or Deferred, admitted highest class first
+	size_t ActiveLowPriority = 0;
+
+	std::vector<Request*> Active; // Requests attached to MultiHandle
+	std::vector<CURL*> IdleHandles; // Reset easy handles waiting for the next request
+	TimerWheel<Request*> Deferred{ std::chrono::milliseconds( 1 ) }; // Held back by a rate limit or backing off after a transient failure
+	std::vector<Request*> Due; // Reused by StartDeferred
+	std::minstd_rand Jitter{ static_cast<std::minstd_rand::result_type>( Clock::now().time_since_epoch().count() ) };
+	std::atomic<size_t> Succeeded{ 0 };
+	std::atomic<size_t> Failed{ 0 };
+
+	std::mutex FinishedLock;
+	std::vector<Completion> Finished; // Waiting for the game thread to collect
+
+	static std::atomic<RequestId> NextId; // Process-wide so ids stay unique across Configure
+
+	std::thread Worker;
+	std::atomic<bool> StopWorker{ false };
+	std::atomic<bool> Draining{ false }; // Submit rejects new work once set
 
 	class TelegramNotifications* telegramNotf_{ nullptr };
 	class DiscordNotifications* discordNotf_{ nullptr };
 
-	AsyncRequests();
+	AsyncRequests( const Options& options );
 	~AsyncRequests();
 public:
 	static void Initialize();
+	static void Initialize( const Options& options );
+	static void Configure( const Options& options );
 
 	static TelegramNotifications* Telegram();
 	static DiscordNotifications* Discord();
 
+	static RequestId ReserveId(); // For requests that need their id before they are submitted
+	// Game thread only. 0 means send request; otherwise it was taken as a repeat and the summary's id is returned.
+	// limit is the provider's maximum text length in code points
+	static RequestId Deduplicate( Request* request, size_t limit );
+	static bool Deduplicating();
+	// Both take ownership; a returned id of 0 means the request was rejected.
+	// A rejected request that already carries a reserved id still completes, as dropped
+	static RequestId Submit( Request* request );
+	static std::vector<RequestId> Submit( const std::vector<Request*>& requests );
 	static void MultiPerform();
+	static void TakeCompleted( std::vector<Completion>& completions ); // Game thread only
+	// Backpressure for scripts, safe from any thread
+	static size_t QueueDepth(); // Accepted but not started yet
+	static size_t InFlight();
 
+	// Game thread only. Stops accepting work and keeps driving transfers until none are left or timeoutMs passes
+	static DrainReport Drain( long timeoutMs );
 	static void UnInitialize();
+private:
+	RequestId Enqueue( Request* request );
+	void Tick( int pollTimeoutMs );
+	void WorkerLoop();
+	void Wake(); // Breaks the worker out of its wait
+
+	size_t Outstanding() const; // Valid only on the thread driving MultiHandle
+	size_t WaitingCount() const;
+	void StartSubmitted();
+	void StartDeferred();
+	void StartWaiting();
+	bool Capped( ePriority priority ) const;
+	void Admit( Request* request, Clock::time_point now );
+	void Defer( Request* request, Clock::time_point when );
+	int PollTimeout( int maximumMs );
+	void Start( Request* request );
+	CURL* AcquireHandle();
+	void ReleaseHandle( CURL* handle );
+	void HarvestCompleted();
+	void Complete( Request* request, CURLcode result );
+	void Finish( Request* request, bool dropped );
+	void Reject( Request* request ); // Submit refused it before it was queued
+	bool ShouldRetry( const Request& request ) const;
+	Clock::duration Backoff( unsigned attempts );
+
+	static size_t WriteResponse( char* data, size_t size, size_t count, void* userdata );
+	static size_t WriteHeader( char* data, size_t size, size_t count, void* userdata );
+	static size_t ReadBody( char* buffer, size_t size, size_t count, void* userdata );
+	static int SeekBody( void* userdata, curl_off_t offset, int origin );
 }; // class AsyncRequests
 
 #endif // !_ASYNC_REQUESTS_H_
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "Coalescer.h"
+#include "AsyncRequests.h"
+#include "Utility.h"
+#include <algorithm>
+
+Coalescer::~Coalescer() {
+	for ( auto& [key, pending] : Queue )
+		delete pending.Batch;
+}
+
+RequestId Coalescer::Add( std::string key, Request* request ) {
+	std::string_view text = request->View( request->Fields[request->TextField].Data );
+	size_t codePoints = Utility::CountCodePoints( text );
+	auto pending = Queue.find( key );
+	if ( codePoints >= Limit || request->Next ) { // Nothing could be joined to it anyway
+		if ( pending != Queue.end() ) { // Keep it behind what was written before it
+			RequestId batch = AsyncRequests::Submit( pending->second.Batch );
+			Queue.erase( pending );
+			if ( batch == 0 ) { // Refused, and completed as dropped; sending this one would reorder the chat
+				delete request;
+				return 0;
+			}
+		}
+		return AsyncRequests::Submit( request );
+	}
+
+	Clock::time_point now = Clock::now();
+	if ( pending != Queue.end() ) {
+		Pending& open = pending->second;
+		if ( open.CodePoints + 1 + codePoints <= Limit ) {
+			Request::Span& batched = open.Batch->Fields[open.Batch->TextField].Data;
+			open.Batch->Append( batched, "\n" );
+			open.Batch->Append( batched, text ); // In place while the text ends the batch's arena
+			open.CodePoints += 1 + codePoints;
+			delete request;
+			return open.Batch->Id;
+		}
+		RequestId batch = AsyncRequests::Submit( open.Batch ); // Full, send it and start over
+		Queue.erase( pending );
+		if ( batch == 0 ) { // Refused, and completed as dropped; sending this one would reorder the chat
+			delete request;
+			return 0;
+		}
+	}
+
+	request->Id = AsyncRequests::ReserveId();
+	Queue.emplace( std::move( key ), Pending{ request, codePoints, now + Window } );
+	NextDeadline = std::min( NextDeadline, now + Window );
+	return request->Id;
+}
+
+size_t Coalescer::Flush( Clock::time_point now, bool everything ) {
+	if ( !everything && NextDeadline > now )
+		return 0; // Called every frame, the map is only walked when a window has closed
+	NextDeadline = Clock::time_point::max();
+	size_t rejected = 0;
+	for ( auto pending = Queue.begin(); pending != Queue.end(); ) {
+		if ( everything || pending->second.Deadline <= now ) {
+			if ( AsyncRequests::Submit( pending->second.Batch ) == 0 )
+				++rejected;
+			pending = Queue.erase( pending );
+		} else {
+			NextDeadline = std::min( NextDeadline, pending->second.Deadline );
+			++pending;
+		}
+	}
+	return rejected;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef _COALESCER_H_
+#define _COALESCER_H_
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include "Request.h"
+
+// Joins texts sent to the same destination within a short window into one
+// request. Lives on the game thread, in front of AsyncRequests::Submit.
+class Coalescer
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct Pending
+	{
+		Request* Batch;
+		size_t CodePoints;
+		Clock::time_point Deadline;
+	}; // struct Pending
+
+	std::unordered_map<std::string, Pending> Queue;
+	Clock::time_point NextDeadline = Clock::time_point::max(); // Flush has nothing to do before this
+	Clock::duration Window = Clock::duration::zero();
+	size_t Limit; // Provider's MAX_CHARACTER
+public:
+	explicit Coalescer( size_t limit ) : Limit( limit ) {};
+	~Coalescer();
+
+	void SetWindow( Clock::duration window ) { Window = window; }
+	bool Enabled() const { return Window > Clock::duration::zero(); }
+
+	// Takes ownership of request; messages merged into one request share its id
+	RequestId Add( std::string key, Request* request );
+	size_t Flush( Clock::time_point now, bool everything = false ); // Returns how many batches Submit refused, each completed as dropped
+}; // class Coalescer
+
+#endif // !_COALESCER_H_
\ No newline at end of file
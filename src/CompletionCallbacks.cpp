@@ -0,0 +1,178 @@
+#include "CompletionCallbacks.h"
+#include "AsyncRequests.h"
+
+CompletionCallbacks* CompletionCallbacks::self{ nullptr };
+
+CompletionCallbacks::~CompletionCallbacks() {
+	for ( auto& [id, awaiter] : Awaiters )
+		luaL_unref( Runner, LUA_REGISTRYINDEX, awaiter.Reference ); // The registry is shared, the awaiting coroutine may be long gone
+	Callbacks.clear(); // Their references live on Runner, release them while it is still anchored
+	luaL_unref( Runner, LUA_REGISTRYINDEX, RunnerReference );
+}
+
+void CompletionCallbacks::Initialize( lua_State* L ) {
+	if ( !self ) {
+		self = new CompletionCallbacks();
+		self->Runner = lua_newthread( L ); // Lua 5.1 has no way back to the main thread from a coroutine, so keep a thread of our own
+		self->RunnerReference = luaL_ref( L, LUA_REGISTRYINDEX );
+	}
+}
+
+void CompletionCallbacks::Register( RequestId id, const sol::optional<sol::protected_function>& callback ) {
+	if ( !self || id == 0 )
+		return;
+	self->Pending.insert( id );
+	if ( callback )
+		self->Callbacks.emplace( id, sol::protected_function( self->Runner, *callback ) ); // Not bound to the calling coroutine, which may be suspended or collected by dispatch time
+}
+
+sol::function CompletionCallbacks::CreateAwait( sol::state_view lua ) {
+	// Lua 5.1 cannot return into a C function after lua_yield, so the check of who resumed us lives in Lua
+	static constexpr const char* AWAIT = R"(
+		local suspend, yield = ...
+		return function( id )
+			local token, requestId, status, latency, messageId, err = suspend( id )
+			if token == nil then -- Already finished
+				return requestId, status, latency, messageId, err
+			end
+			local resumed
+			repeat -- Anyone else resuming us, such as the script scheduler, is answered by yielding again
+				resumed, requestId, status, latency, messageId, err = yield()
+			until resumed == token
+			return requestId, status, latency, messageId, err
+		end
+	)";
+	sol::protected_function factory = lua.load( AWAIT, "=await" );
+	return factory( &CompletionCallbacks::Suspend, lua["coroutine"]["yield"] );
+}
+
+int CompletionCallbacks::Suspend( lua_State* L ) {
+	RequestId id = static_cast<RequestId>( luaL_checknumber( L, 1 ) );
+	if ( !self || id == 0 )
+		return luaL_error( L, "await: unknown request" );
+
+	auto recent = self->Recent.find( id );
+	if ( recent != self->Recent.end() ) { // Already finished, no need to suspend
+		lua_pushnil( L );
+		return 1 + PushResults( L, recent->second );
+	}
+	if ( self->Pending.find( id ) == self->Pending.end() )
+		return luaL_error( L, "await: unknown or expired request" ); // Never issued, or finished too long ago to be remembered
+
+	if ( lua_pushthread( L ) ) // Pushes L and reports whether it is the main thread
+		return luaL_error( L, "await must be called from a coroutine" );
+	int reference = luaL_ref( L, LUA_REGISTRYINDEX );
+	uintptr_t token = self->NextToken++;
+	self->Awaiters.emplace( id, Awaiter{ L, reference, token } );
+	lua_pushlightuserdata( L, reinterpret_cast<void*>( token ) ); // Never something another resumer passes
+	return 1;
+}
+
+void CompletionCallbacks::Abandon() {
+	if ( !self )
+		return;
+	for ( RequestId id : self->Pending ) {
+		Completion& completion = self->Abandoned.emplace_back();
+		completion.Id = id;
+		completion.Dropped = true;
+	}
+}
+
+void CompletionCallbacks::Dispatch() {
+	if ( !self || self->Dispatching ) // UnLoad from a callback, the outer call owns Batch
+		return;
+	AsyncRequests::TakeCompleted( self->Batch );
+	self->Batch.insert( self->Batch.end(), self->Abandoned.begin(), self->Abandoned.end() );
+	self->Abandoned.clear();
+	self->Dispatching = true;
+	for ( const Completion& completion : self->Batch ) {
+		if ( self->Closing )
+			break;
+		self->Pending.erase( completion.Id );
+		self->Remember( completion );
+
+		for ( auto awaiter = self->Awaiters.find( completion.Id ); !self->Closing && awaiter != self->Awaiters.end(); awaiter = self->Awaiters.find( completion.Id ) ) {
+			Awaiter suspended = awaiter->second;
+			self->Awaiters.erase( awaiter );
+			self->Resume( suspended, completion );
+		}
+
+		sol::optional<const char*> error;
+		if ( const char* message = ErrorOf( completion ) )
+			error = message;
+		for ( auto callback = self->Callbacks.find( completion.Id ); !self->Closing && callback != self->Callbacks.end(); callback = self->Callbacks.find( completion.Id ) ) {
+			sol::protected_function function = std::move( callback->second );
+			self->Callbacks.erase( callback ); // Before the call, so a callback may send again freely
+
+			// callback( id, httpStatus, latencyMs, messageId, error )
+			sol::protected_function_result result = function( completion.Id, completion.ResponseCode, completion.LatencyMs, completion.MessageId, error );
+			if ( !result.valid() ) {
+				sol::error failure = result;
+				self->Report( "callback", failure.what() );
+			}
+		}
+	}
+	self->Dispatching = false;
+	if ( self->Closing ) // A callback unloaded the library, the rest of the batch is not delivered
+		UnInitialize();
+}
+
+void CompletionCallbacks::UnInitialize() {
+	if ( self ) {
+		if ( self->Dispatching ) { // Called from a callback, Dispatch is still walking our maps
+			self->Closing = true;
+			return;
+		}
+		delete self;
+		self = nullptr;
+	}
+}
+
+void CompletionCallbacks::Remember( const Completion& completion ) {
+	if ( RecentOrder.size() >= RECENT_CAPACITY ) {
+		Recent.erase( RecentOrder.front() );
+		RecentOrder.pop_front();
+	}
+	Recent[completion.Id] = completion;
+	RecentOrder.push_back( completion.Id );
+}
+
+void CompletionCallbacks::Resume( const Awaiter& awaiter, const Completion& completion ) {
+	lua_State* thread = awaiter.Thread;
+	if ( lua_status( thread ) == LUA_YIELD ) { // Not running, and neither finished nor dead
+		lua_pushlightuserdata( thread, reinterpret_cast<void*>( awaiter.Token ) );
+		int status = lua_resume( thread, nullptr, 1 + PushResults( thread, completion ) ); // sol2 compat form, maps to the 5.1 API
+		if ( status != 0 && status != LUA_YIELD ) { // The coroutine died; its error message is all that is left
+			Report( "awaiting coroutine", lua_tostring( thread, -1 ) );
+			lua_pop( thread, 1 );
+		}
+	}
+	luaL_unref( Runner, LUA_REGISTRYINDEX, awaiter.Reference );
+}
+
+void CompletionCallbacks::Report( const char* what, const char* message ) {
+	lua_getglobal( Runner, "print" );
+	lua_pushfstring( Runner, "NotificationLibrary: %s failed: %s", what, message ? message : "unknown error" );
+	if ( lua_pcall( Runner, 1, 0, 0 ) != 0 )
+		lua_pop( Runner, 1 ); // No usable print(), nowhere left to report to
+}
+
+const char* CompletionCallbacks::ErrorOf( const Completion& completion ) {
+	if ( completion.Dropped )
+		return "dropped";
+	if ( completion.Result != CURLE_OK )
+		return curl_easy_strerror( completion.Result );
+	return nullptr;
+}
+
+int CompletionCallbacks::PushResults( lua_State* L, const Completion& completion ) {
+	lua_pushnumber( L, completion.Id );
+	lua_pushnumber( L, completion.ResponseCode );
+	lua_pushnumber( L, completion.LatencyMs );
+	lua_pushnumber( L, static_cast<lua_Number>( completion.MessageId ) );
+	if ( const char* error = ErrorOf( completion ) )
+		lua_pushstring( L, error );
+	else
+		lua_pushnil( L );
+	return 5;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef _COMPLETION_CALLBACKS_H_
+#define _COMPLETION_CALLBACKS_H_
+
+#include <sol.hpp>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Request.h"
+
+class CompletionCallbacks
+{
+	static constexpr size_t RECENT_CAPACITY = 256; // Completions kept for late await() calls
+
+	static CompletionCallbacks* self;
+
+	struct Awaiter
+	{
+		lua_State* Thread;
+		int Reference; // Keeps the coroutine alive while it is suspended
+		uintptr_t Token; // Passed back on resume, await() ignores any other resumer
+	}; // struct Awaiter
+
+	// Multimaps: coalesced messages share one request id
+	std::unordered_multimap<RequestId, sol::protected_function> Callbacks;
+	std::unordered_multimap<RequestId, Awaiter> Awaiters;
+	std::unordered_map<RequestId, Completion> Recent;
+	std::deque<RequestId> RecentOrder;
+	lua_State* Runner = nullptr; // Our own thread: callbacks run and references are released here, never on a script coroutine
+	int RunnerReference = LUA_NOREF;
+	std::unordered_set<RequestId> Pending; // Handed to the script, no completion seen yet
+	std::vector<Completion> Abandoned; // Discarded by Configure, reported by the next Dispatch
+	std::vector<Completion> Batch; // Reused every tick
+	uintptr_t NextToken = 1;
+	bool Dispatching = false;
+	bool Closing = false; // UnInitialize was called from a callback, Dispatch tears down once it returns
+
+	CompletionCallbacks() {};
+	~CompletionCallbacks();
+public:
+	static void Initialize( lua_State* L );
+
+	// Every id returned to the script goes through here, so await() can tell pending ids from unknown ones
+	static void Register( RequestId id, const sol::optional<sol::protected_function>& callback );
+	static sol::function CreateAwait( sol::state_view lua ); // await( id ), yields the calling coroutine
+	static void Abandon(); // The requests behind every pending id were discarded
+	static void Dispatch(); // Game thread, once per tick
+
+	static void UnInitialize();
+private:
+	static int Suspend( lua_State* L ); // lua_CFunction behind await()
+	void Remember( const Completion& completion );
+	void Resume( const Awaiter& awaiter, const Completion& completion );
+	void Report( const char* what, const char* message ); // Script errors go to print(), there is no caller to raise them in
+
+	static const char* ErrorOf( const Completion& completion );
+	static int PushResults( lua_State* L, const Completion& completion );
+}; // class CompletionCallbacks
+
+#endif // !_COMPLETION_CALLBACKS_H_
\ No newline at end of file
@@ -1,42 +1,143 @@
 #include "DiscordNotifications.h"
+#include "AsyncRequests.h"
+#include "MessageSplitter.h"
 #include "Utility.h"
-#include <curl/mprintf.h>
+#include <algorithm>
 
-DiscordNotifications::DiscordNotifications( CURLM* multihandle_ ) : MultiHandle( multihandle_ ) { }
+RequestId DiscordNotifications::sendMessage( std::string_view webhookURL, std::string_view content, std::string_view username, ePriority priority ) {
+	return Send( { webhookURL, content, username, priority } ); // Runing
+}
 
-void DiscordNotifications::sendMessage( std::string webhookURL, std::string content, std::string username ) {
-#pragma warning( push )
-#pragma warning( disable : 26812)
+std::vector<RequestId> DiscordNotifications::sendMessages( const std::vector<Message>& messages ) {
+	if ( Coalesce.Enabled() || AsyncRequests::Deduplicating() ) {
+		std::vector<RequestId> ids;
+		ids.reserve( messages.size() );
+		for ( const Message& message : messages )
+			ids.push_back( Send( message ) );
+		return ids;
+	}
+	std::vector<Request*> requests;
+	requests.reserve( messages.size() );
+	for ( const Message& message : messages )
+		requests.push_back( CreateMessage( message ) );
+	return AsyncRequests::Submit( requests );
+}
+
+RequestId DiscordNotifications::Send( const Message& message ) {
+	Request* request = CreateMessage( message );
+	if ( RequestId repeat = AsyncRequests::Deduplicate( request, MAX_CHARACTER ) )
+		return repeat; // Counted into a later summary instead of sent
+	if ( !Coalesce.Enabled() || message.Priority == ePriority::HIGH ) // Alerts never wait for a window
+		return AsyncRequests::Submit( request );
+
+	std::string key( request->View( request->Destination ) ); // Same webhook posting under the same name
+	key.append( 1, '\0' ).append( message.Username ).append( 1, '\0' ).append( 1, static_cast<char>( '0' + static_cast<int>( message.Priority ) ) );
+	return Coalesce.Add( std::move( key ), request );
+}
+
+Request* DiscordNotifications::CreateMessage( const Message& message ) {
+	Request* request = new Request();
+	request->Provider = eProvider::DISCORD;
+	request->Priority = message.Priority;
+	request->Arena.reserve( ARENA_OVERHEAD + message.WebhookURL.size() + ( message.Username.size() + message.Content.size() ) * Utility::MAX_UTF8_RATIO );
+	request->URL = request->Store( message.WebhookURL );
+	request->Destination = request->URL;
 
-	CURL* cURL = curl_easy_init();
-	struct curl_slist* Headers{ nullptr };
-	curl_mime* MIME{ nullptr };
-	curl_mimepart* MIMEPart{ nullptr };
+	if ( !message.Username.empty() ) // Omitted batch entries keep the webhook's own name
+		request->AddFieldWith( "username", [&message]( std::string& arena ) { Utility::win1251ToUTF8( message.Username, arena ); } );
+	request->AddFieldWith( "content", [&message]( std::string& arena ) { Utility::win1251ToUTF8( message.Content, arena ); } );
+	request->TextField = static_cast<int>( request->FieldCount - 1 ); // Last in the arena, so merged contents grow in place
+	MessageSplitter::SplitRequest( request, request->TextField, MAX_CHARACTER, MessageSplitter::eMarkup::MARKDOWN ); // Longer contents are rejected by the API
+	return request;
+}
 
-	if ( cURL ) {
-		curl_easy_setopt( cURL, CURLOPT_POST, 1 ); // Request Method
-		curl_easy_setopt( cURL, CURLOPT_URL, webhookURL.c_str() ); // Request URL
-		curl_easy_setopt( cURL, CURLOPT_DEFAULT_PROTOCOL, "https" ); // Request Protocol
+DiscordNotifications::Clock::duration DiscordNotifications::Admit( Request& request, Clock::time_point now ) {
+	if ( GlobalResetAt > now )
+		return GlobalResetAt - now;
 
-		curl_easy_setopt( cURL, CURLOPT_HTTPHEADER, Headers ); // Installing Headers
+	PruneBuckets( now );
+	Key.assign( request.View( request.Destination ) );
+	auto webhook = WebhookBuckets.try_emplace( Key, Key ).first; // Unknown: a one-post bucket under the URL until the response names the real one
+	Bucket& bucket = Buckets[webhook->second];
+	if ( bucket.ResetAt <= now ) { // The window rolled over, open the next one ourselves; responses correct it
+		bucket.Remaining = bucket.Limit;
+		bucket.ResetAt = now + bucket.Window;
+	}
+	if ( bucket.Remaining <= 0 ) // Hold until the bucket resets
+		return bucket.ResetAt == Clock::time_point::max() ? Clock::duration( FIRST_RESPONSE_POLL ) : bucket.ResetAt - now;
+	--bucket.Remaining; // Count in-flight posts against the window
+	return Clock::duration::zero();
+}
 
-		curl_slist_append( Headers, "Content-Type: multipart/form-data" ); // Header -> Content-Type
-		curl_slist_append( Headers, "charset=utf-8" ); // Header -> Charset
+DiscordNotifications::Clock::duration DiscordNotifications::RetryAfter( const Request& request, Clock::time_point now ) {
+	std::string_view headers = request.ResponseHeaders;
+	std::string_view bucketId = Utility::FindHeader( headers, "X-RateLimit-Bucket" );
+	Bucket* bucket{ nullptr };
+	Key.assign( request.View( request.Destination ) );
+	auto webhook = WebhookBuckets.find( Key );
+	if ( !bucketId.empty() ) {
+		if ( webhook == WebhookBuckets.end() ) // Swept while the post was in flight
+			webhook = WebhookBuckets.try_emplace( Key ).first;
+		if ( webhook->second != bucketId ) {
+			if ( webhook->second == Key )
+				Buckets.erase( Key ); // The provisional bucket, the posts held by it move to the real one
+			webhook->second.assign( bucketId );
+		}
+		bucket = &Buckets[webhook->second];
 
-		MIME = curl_mime_init( cURL ); // Initialize MultipurposeInternetMailExtensions
-		
-		MIMEPart = curl_mime_addpart( MIME ); // First MIME's Part
-		curl_mime_name( MIMEPart, "content" );
-		curl_mime_data( MIMEPart, Utility::win1251ToUTF8( content.c_str() ).c_str(), CURL_ZERO_TERMINATED );
+		std::string_view limit = Utility::FindHeader( headers, "X-RateLimit-Limit" );
+		std::string_view remaining = Utility::FindHeader( headers, "X-RateLimit-Remaining" );
+		std::string_view resetAfter = Utility::FindHeader( headers, "X-RateLimit-Reset-After" );
+		if ( !limit.empty() )
+			bucket->Limit = std::max( 1l, static_cast<long>( Utility::ParseNumber( limit ) ) );
+		if ( !resetAfter.empty() ) {
+			auto window = std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( Utility::ParseNumber( resetAfter ) ) );
+			bool fresh = bucket->ResetAt == Clock::time_point::max();
+			if ( fresh || now + window > bucket->ResetAt - bucket->Window ) { // Not a late answer about a window we already left
+				if ( !remaining.empty() ) { // Our own count also covers posts still in flight, the server's only those it has seen
+					long left = static_cast<long>( Utility::ParseNumber( remaining ) );
+					bucket->Remaining = fresh ? left : std::min( bucket->Remaining, left );
+				}
+				bucket->ResetAt = now + window;
+				bucket->Window = std::max( bucket->Window, window );
+			}
+		}
+	} else if ( webhook != WebhookBuckets.end() && webhook->second == Key ) {
+		Buckets[Key].Remaining = 1; // No bucket in the answer, let the next post ask
+	}
 
-		MIMEPart = curl_mime_addpart( MIME ); // Second MIME's Part
-		curl_mime_name( MIMEPart, "username" );
-		curl_mime_data( MIMEPart, Utility::win1251ToUTF8( username.c_str() ).c_str(), CURL_ZERO_TERMINATED );
+	if ( request.ResponseCode != 429 )
+		return Clock::duration::zero();
 
-		curl_easy_setopt( cURL, CURLOPT_MIMEPOST, MIME ); // Install MIME
+	// Body: {"message":"You are being rate limited.","retry_after":0.65,"global":false}
+	double seconds = Utility::FindJSONNumber( request.Response, "retry_after", -1.0 );
+	if ( seconds < 0.0 )
+		seconds = Utility::ParseNumber( Utility::FindHeader( headers, "Retry-After" ), 1.0 );
+	auto delay = std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( seconds ) );
 
-		curl_multi_add_handle( MultiHandle, cURL ); // Runing
+	if ( !Utility::FindHeader( headers, "X-RateLimit-Global" ).empty() )
+		GlobalResetAt = std::max( GlobalResetAt, now + delay );
+	if ( bucket ) {
+		bucket->Remaining = 0;
+		bucket->ResetAt = std::max( bucket->ResetAt, now + delay );
 	}
+	return delay;
+}
 
-#pragma warning( pop )
+void DiscordNotifications::PruneBuckets( Clock::time_point now ) {
+	if ( now < NextPrune || WebhookBuckets.size() + Buckets.size() < MAX_IDLE_BUCKETS )
+		return;
+	NextPrune = now + PRUNE_INTERVAL; // A broadcast to many webhooks must not rescan the maps on every Admit
+	for ( auto bucket = Buckets.begin(); bucket != Buckets.end(); ) {
+		if ( bucket->second.ResetAt <= now ) // Window over, the next post opens a fresh one anyway
+			bucket = Buckets.erase( bucket );
+		else
+			++bucket;
+	}
+	for ( auto webhook = WebhookBuckets.begin(); webhook != WebhookBuckets.end(); ) {
+		if ( Buckets.find( webhook->second ) == Buckets.end() )
+			webhook = WebhookBuckets.erase( webhook );
+		else
+			++webhook;
+	}
 }
\ No newline at end of file
@@ -2,18 +2,65 @@
 #define _DISCORD_NOTIFICATIONS_H_
 
 #include <curl/curl.h>
+#include <chrono>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Coalescer.h"
+#include "Request.h"
 
 class DiscordNotifications
 {
+	using Clock = std::chrono::steady_clock;
+
 	static constexpr int MAX_CHARACTER = 2000;
+	static constexpr size_t ARENA_OVERHEAD = 32; // Field names
+	static constexpr std::chrono::milliseconds FIRST_RESPONSE_POLL{ 250 }; // Posts behind a webhook's first one check back this often
+	static constexpr std::chrono::seconds DEFAULT_WINDOW{ 1 }; // Until a response shows the real one
+	static constexpr size_t MAX_IDLE_BUCKETS = 1024;
+	static constexpr std::chrono::seconds PRUNE_INTERVAL{ 10 };
+
+	struct Bucket
+	{
+		long Limit = 1; // X-RateLimit-Limit, posts per window
+		long Remaining = 1;
+		Clock::time_point ResetAt = Clock::time_point::max(); // max until a response tells when the window ends
+		Clock::duration Window = DEFAULT_WINDOW; // Longest X-RateLimit-Reset-After seen, the length of the window we open ourselves
+	}; // struct Bucket
+
+	// Touched only by the thread driving AsyncRequests
+	std::unordered_map<std::string, std::string> WebhookBuckets; // Webhook URL -> X-RateLimit-Bucket, or the URL itself until the first response
+	std::unordered_map<std::string, Bucket> Buckets;
+	Clock::time_point GlobalResetAt; // Set by a 429 with X-RateLimit-Global
+	Clock::time_point NextPrune; // Idle buckets are swept at most once per PRUNE_INTERVAL
+	std::string Key; // Reused for bucket lookups, so Admit does not allocate
 
-	CURLM* MultiHandle;
+	Coalescer Coalesce{ MAX_CHARACTER }; // Game thread only
 public:
-	DiscordNotifications( CURLM* mhandle );
+	DiscordNotifications() {};
 	~DiscordNotifications() {};
 
-	void sendMessage( std::string webhookURL, std::string content, std::string username );
+	struct Message
+	{
+		std::string_view WebhookURL;
+		std::string_view Content;
+		std::string_view Username;
+		ePriority Priority = ePriority::NORMAL;
+	}; // struct Message
+	RequestId sendMessage( std::string_view webhookURL, std::string_view content, std::string_view username, ePriority priority );
+	std::vector<RequestId> sendMessages( const std::vector<Message>& messages );
+
+	void SetCoalesceWindow( Clock::duration window ) { Coalesce.SetWindow( window ); }
+	size_t FlushCoalesced( Clock::time_point now, bool everything = false ) { return Coalesce.Flush( now, everything ); }
+
+	// Engine hooks, see TelegramNotifications
+	Clock::duration Admit( Request& request, Clock::time_point now );
+	Clock::duration RetryAfter( const Request& request, Clock::time_point now );
+private:
+	Request* CreateMessage( const Message& message );
+	RequestId Send( const Message& message );
+	void PruneBuckets( Clock::time_point now );
 }; // class DiscordNotifications
 
 #endif // !_DISCORD_NOTIFICATIONS_H_
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "DuplicateFilter.h"
+#include "AsyncRequests.h"
+#include "Utility.h"
+#include <algorithm>
+
+DuplicateFilter::~DuplicateFilter() {
+	for ( Slot& slot : Slots )
+		if ( slot.Hash > REMOVED )
+			delete slot.Summary;
+}
+
+RequestId DuplicateFilter::Add( Request* request, size_t limit, Clock::time_point now ) {
+	if ( request->TextField < 0 || request->Next ) // Media and split messages always go out
+		return 0;
+	uint64_t hash = Hash( request->View( request->Destination ), request->View( request->Fields[request->TextField].Data ) );
+
+	Slot* slot = Find( hash );
+	if ( slot->Hash == hash && slot->Expires > now ) {
+		++slot->Repeats;
+		if ( slot->Summary ) {
+			delete request;
+		} else {
+			request->Id = AsyncRequests::ReserveId();
+			slot->Summary = request;
+		}
+		return slot->Summary->Id;
+	}
+	if ( slot->Hash == hash ) { // Expired but not swept yet, send the summary before starting over
+		Flush( now );
+		slot = Find( hash );
+	}
+
+	if ( ( Used + 1 ) * 2 > Slots.size() ) {
+		Rehash( Live * 4 > Slots.size() ? Slots.size() * 2 : Slots.size() ); // Same size just drops removed slots
+		slot = Find( hash );
+	}
+	if ( slot->Hash == EMPTY )
+		++Used;
+	++Live;
+	*slot = Slot{ hash, now + Window, 0, nullptr, limit };
+	NextExpiry = std::min( NextExpiry, slot->Expires );
+	return 0;
+}
+
+size_t DuplicateFilter::Flush( Clock::time_point now, bool everything ) {
+	if ( Live == 0 || ( !everything && NextExpiry > now ) )
+		return 0;
+	NextExpiry = Clock::time_point::max();
+	size_t rejected = 0;
+	for ( Slot& slot : Slots ) {
+		if ( slot.Hash <= REMOVED )
+			continue;
+		if ( !everything && slot.Expires > now ) {
+			NextExpiry = std::min( NextExpiry, slot.Expires );
+			continue;
+		}
+		if ( slot.Summary ) {
+			Request* summary = slot.Summary;
+			Request::Span& text = summary->Fields[summary->TextField].Data;
+			std::string suffix = " \xC3\x97" + std::to_string( slot.Repeats ); // " ×N" in UTF-8
+			if ( Utility::CountCodePoints( summary->View( text ) ) + Utility::CountCodePoints( suffix ) <= slot.Limit )
+				summary->Append( text, suffix ); // Otherwise the API would reject it, the repeat goes out as is
+			if ( AsyncRequests::Submit( slot.Summary ) == 0 )
+				++rejected;
+		}
+		slot = Slot{ REMOVED, {}, 0, nullptr, 0 };
+		--Live;
+	}
+	return rejected;
+}
+
+uint64_t DuplicateFilter::Hash( std::string_view destination, std::string_view text ) {
+	// 64-bit FNV-1a over destination, a separator and text
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&hash]( std::string_view bytes ) {
+		for ( unsigned char byte : bytes ) {
+			hash ^= byte;
+			hash *= 1099511628211ull;
+		}
+	};
+	mix( destination );
+	mix( std::string_view( "\0", 1 ) );
+	mix( text );
+	return hash > REMOVED ? hash : hash + 2; // Keep clear of the marker values
+}
+
+DuplicateFilter::Slot* DuplicateFilter::Find( uint64_t hash ) {
+	size_t mask = Slots.size() - 1;
+	Slot* reusable{ nullptr };
+	for ( size_t i = hash & mask;; i = ( i + 1 ) & mask ) {
+		Slot& slot = Slots[i];
+		if ( slot.Hash == hash )
+			return &slot;
+		if ( slot.Hash == REMOVED && !reusable )
+			reusable = &slot;
+		else if ( slot.Hash == EMPTY )
+			return reusable ? reusable : &slot;
+	}
+}
+
+void DuplicateFilter::Rehash( size_t capacity ) {
+	std::vector<Slot> old( std::max( capacity, MIN_CAPACITY ) );
+	old.swap( Slots );
+	Used = Live;
+	for ( Slot& slot : old )
+		if ( slot.Hash > REMOVED )
+			*Find( slot.Hash ) = slot;
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef _DUPLICATE_FILTER_H_
+#define _DUPLICATE_FILTER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Request.h"
+
+// Counts repeats of a text to the same destination within a window instead
+// of sending them. The first copy goes out at once, the repeats become one
+// "text ×N" request when the window ends. Lives on the game thread.
+class DuplicateFilter
+{
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr uint64_t EMPTY = 0;
+	static constexpr uint64_t REMOVED = 1;
+	static constexpr size_t MIN_CAPACITY = 64;
+
+	// Open addressing with linear probing; the hash is the key, (destination, text) is not kept
+	struct Slot
+	{
+		uint64_t Hash = EMPTY;
+		Clock::time_point Expires;
+		size_t Repeats = 0;
+		Request* Summary{ nullptr }; // First repeat, sent with the suffix when the window ends
+		size_t Limit = 0; // Provider's MAX_CHARACTER, the suffix is left off rather than going over it
+	}; // struct Slot
+
+	std::vector<Slot> Slots = std::vector<Slot>( MIN_CAPACITY );
+	size_t Used = 0; // Live and removed slots, both lengthen probes
+	size_t Live = 0;
+	Clock::time_point NextExpiry = Clock::time_point::max();
+	Clock::duration Window = Clock::duration::zero();
+public:
+	~DuplicateFilter();
+
+	void SetWindow( Clock::duration window ) { Window = window; }
+	bool Enabled() const { return Window > Clock::duration::zero(); }
+
+	// Returns 0 when request should be sent; otherwise takes ownership and returns the summary's id
+	RequestId Add( Request* request, size_t limit, Clock::time_point now );
+	size_t Flush( Clock::time_point now, bool everything = false ); // Returns how many summaries Submit refused, each completed as dropped
+private:
+	static uint64_t Hash( std::string_view destination, std::string_view text );
+	Slot* Find( uint64_t hash );
+	void Rehash( size_t capacity );
+}; // class DuplicateFilter
+
+#endif // !_DUPLICATE_FILTER_H_
\ No newline at end of file
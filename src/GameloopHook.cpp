@@ -1,5 +1,6 @@
 #include "GameloopHook.h"
 #include "AsyncRequests.h"
+#include "CompletionCallbacks.h"
 
 GameloopHook* GameloopHook::self{ nullptr };
 
@@ -26,4 +27,5 @@ void GameloopHook::UnInitialize() {
 
 void GameloopHook::GameloopHooked( SRHook::CPU& CPU ) {
 	AsyncRequests::MultiPerform();
+	CompletionCallbacks::Dispatch();
 }
\ No newline at end of file
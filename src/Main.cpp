@@ -1,15 +1,64 @@
 #include <sol.hpp>
 #include "GameloopHook.h"
 #include "AsyncRequests.h"
+#include "CompletionCallbacks.h"
 
 void InitializeGameloopHook( sol::table& module ) {
 	GameloopHook::Initialize();
 	module.set_function( "UnHook", &GameloopHook::UnInitialize );
 }
 
-void InitializeCurl( sol::table& module ) {
+void InitializeCurl( sol::state_view& lua, sol::table& module ) {
+	lua.new_enum<AsyncRequests::eOverflowPolicy>( "QueueOverflow", {
+		{ "DROP_OLDEST", AsyncRequests::eOverflowPolicy::DROP_OLDEST },
+		{ "DROP_NEWEST", AsyncRequests::eOverflowPolicy::DROP_NEWEST },
+		{ "BLOCK", AsyncRequests::eOverflowPolicy::BLOCK }
+	});
+	lua.new_enum<ePriority>( "Priority", {
+		{ "HIGH", ePriority::HIGH },
+		{ "NORMAL", ePriority::NORMAL },
+		{ "LOW", ePriority::LOW }
+	});
 	AsyncRequests::Initialize();
-	module.set_function( "UnLoad", &AsyncRequests::UnInitialize );
+	CompletionCallbacks::Initialize( lua.lua_state() );
+	module.set_function( "UnLoad", []( sol::optional<long> timeoutMs ) {
+		AsyncRequests::DrainReport report = AsyncRequests::Drain( timeoutMs.value_or( 0 ) ); // Without a timeout only the coalescing windows are flushed
+		CompletionCallbacks::Dispatch(); // Callbacks and awaiters of the flushed requests still run
+		AsyncRequests::UnInitialize();
+		CompletionCallbacks::UnInitialize(); // Releases references into the script's Lua state
+		return std::make_tuple( report.Flushed, report.Abandoned );
+	});
+	module.set_function( "queueDepth", &AsyncRequests::QueueDepth );
+	module.set_function( "inFlight", &AsyncRequests::InFlight );
+	module["await"] = CompletionCallbacks::CreateAwait( lua );
+	module.set_function( "configure", []( sol::table config ) {
+		AsyncRequests::Options options;
+		options.Threaded = config.get_or( "threaded", options.Threaded );
+		options.QueueCapacity = config.get_or( "queueCapacity", options.QueueCapacity );
+		options.Overflow = config.get_or( "overflow", options.Overflow );
+		options.HandlePoolSize = config.get_or( "handlePoolSize", options.HandlePoolSize );
+		options.MaxCachedConnections = config.get_or( "maxCachedConnections", options.MaxCachedConnections );
+		options.Multiplex = config.get_or( "multiplex", options.Multiplex );
+		options.MaxStreamsPerConnection = config.get_or( "maxStreamsPerConnection", options.MaxStreamsPerConnection );
+		options.MaxConnectionsPerHost = config.get_or( "maxConnectionsPerHost", options.MaxConnectionsPerHost );
+		options.ShareCaches = config.get_or( "shareCaches", options.ShareCaches );
+		options.DNSCacheTimeout = config.get_or( "dnsCacheTimeout", options.DNSCacheTimeout );
+		options.CoalesceWindowMs = config.get_or( "coalesceWindowMs", options.CoalesceWindowMs );
+		options.DedupWindowMs = config.get_or( "dedupWindowMs", options.DedupWindowMs );
+		options.MaxLowPriorityTransfers = config.get_or( "maxLowPriorityTransfers", options.MaxLowPriorityTransfers );
+		options.MaxInFlight = config.get_or( "maxInFlight", options.MaxInFlight );
+		options.SpoolPath = config.get_or<std::string>( "spoolPath", options.SpoolPath );
+		options.SpoolSyncMs = config.get_or( "spoolSyncMs", options.SpoolSyncMs );
+		options.TelegramMaxAttempts = config.get_or( "telegramMaxAttempts", options.TelegramMaxAttempts );
+		options.DiscordMaxAttempts = config.get_or( "discordMaxAttempts", options.DiscordMaxAttempts );
+		options.RetryBaseMs = config.get_or( "retryBaseMs", options.RetryBaseMs );
+		options.RetryMaxMs = config.get_or( "retryMaxMs", options.RetryMaxMs );
+		options.ConnectTimeoutMs = config.get_or( "connectTimeoutMs", options.ConnectTimeoutMs );
+		options.TransferTimeoutMs = config.get_or( "transferTimeoutMs", options.TransferTimeoutMs );
+		options.EventDriven = config.get_or( "eventDriven", options.EventDriven );
+		CompletionCallbacks::Abandon(); // Configure discards whatever has not finished yet
+		AsyncRequests::Configure( options );
+	});
 }
 
 void defineTelegramFunctions(sol::state_view& lua, sol::table& module) {
@@ -23,17 +72,85 @@ void defineTelegramFunctions(sol::state_view& lua, sol::table& module) {
 		{ "DOCUMENT", TelegramNotifications::eFileType::DOCUMENT },
 		{ "VIDEO", TelegramNotifications::eFileType::VIDEO }
 	});
-	module.set_function("sendTelegramMessage", []( sol::this_state ts, std::string botToken, std::string chatId, std::string text, TelegramNotifications::eParseMode parseMode = TelegramNotifications::eParseMode::HTML, bool disableNotification = false, bool protectContent = false ) {
-		AsyncRequests::Telegram()->sendMessage( botToken, chatId, text, parseMode, disableNotification, protectContent );
+	module.set_function("sendTelegramMessage", []( sol::this_state ts, std::string_view botToken, std::string_view chatId, std::string_view text, TelegramNotifications::eParseMode parseMode = TelegramNotifications::eParseMode::HTML, bool disableNotification = false, bool protectContent = false, sol::optional<sol::protected_function> callback = sol::nullopt, sol::optional<ePriority> priority = sol::nullopt ) {
+		RequestId id = AsyncRequests::Telegram()->sendMessage( botToken, chatId, text, parseMode, disableNotification, protectContent, priority.value_or( ePriority::NORMAL ) );
+		CompletionCallbacks::Register( id, callback );
+		return id;
+	});
+	module.set_function("sendTelegramMedia", []( sol::this_state ts, TelegramNotifications::eFileType fileType, std::string_view botToken, std::string_view chatId, std::string_view filePath, std::string_view caption, TelegramNotifications::eParseMode parseMode = TelegramNotifications::eParseMode::HTML, bool disableNotification = false, bool protectContent = false, sol::optional<sol::protected_function> callback = sol::nullopt, sol::optional<ePriority> priority = sol::nullopt ) {
+		RequestId id = AsyncRequests::Telegram()->sendMedia( fileType, botToken, chatId, filePath, caption, parseMode, disableNotification, protectContent, priority.value_or( ePriority::LOW ) ); // Uploads default to the capped class
+		CompletionCallbacks::Register( id, callback );
+		return id;
 	});
-	module.set_function("sendTelegramMedia", []( sol::this_state ts, TelegramNotifications::eFileType fileType, std::string botToken, std::string chatId, std::string filePath, std::string caption, TelegramNotifications::eParseMode parseMode = TelegramNotifications::eParseMode::HTML, bool disableNotification = false, bool protectContent = false ) {
-		AsyncRequests::Telegram()->sendMedia( fileType, botToken, chatId, filePath, caption, parseMode, disableNotification, protectContent );
+	module.set_function("sendTelegramBatch", []( sol::this_state ts, sol::table batch ) {
+		std::vector<TelegramNotifications::Message> messages;
+		std::vector<sol::optional<sol::protected_function>> callbacks;
+		std::vector<size_t> positions; // Index into batch of every accepted message
+		messages.reserve( batch.size() );
+		callbacks.reserve( batch.size() );
+		positions.reserve( batch.size() );
+		for ( size_t i = 1; i <= batch.size(); ++i ) {
+			sol::optional<sol::table> entry = batch[i];
+			if ( !entry )
+				continue;
+			auto botToken = entry->get<sol::optional<std::string_view>>( "botToken" );
+			auto chatId = entry->get<sol::optional<std::string_view>>( "chatId" );
+			auto text = entry->get<sol::optional<std::string_view>>( "text" );
+			if ( !botToken || !chatId || !text )
+				continue; // Malformed entries get id 0, the rest of the batch still goes out
+			TelegramNotifications::Message& message = messages.emplace_back();
+			message.BotToken = *botToken;
+			message.ChatId = *chatId;
+			message.Text = *text;
+			message.ParseMode = entry->get_or( "parseMode", message.ParseMode );
+			message.DisableNotification = entry->get_or( "disableNotification", message.DisableNotification );
+			message.ProtectContent = entry->get_or( "protectContent", message.ProtectContent );
+			message.Priority = entry->get_or( "priority", message.Priority );
+			callbacks.push_back( entry->get<sol::optional<sol::protected_function>>( "callback" ) );
+			positions.push_back( i - 1 );
+		}
+		std::vector<RequestId> ids = AsyncRequests::Telegram()->sendMessages( messages );
+		std::vector<RequestId> results( batch.size(), 0 ); // One slot per batch entry, so ids[i] answers batch[i]
+		for ( size_t i = 0; i < ids.size(); ++i ) {
+			CompletionCallbacks::Register( ids[i], callbacks[i] );
+			results[positions[i]] = ids[i];
+		}
+		return sol::as_table( results );
 	});
 }
 
 void defineDiscordFunctions( sol::table& module ) {
-	module.set_function("sendDiscordMessage", []( sol::this_state ts, std::string webhookURL, std::string content, std::string username ) {
-		AsyncRequests::Discord()->sendMessage( webhookURL, content, username );
+	module.set_function("sendDiscordMessage", []( sol::this_state ts, std::string_view webhookURL, std::string_view content, std::string_view username, sol::optional<sol::protected_function> callback, sol::optional<ePriority> priority ) {
+		RequestId id = AsyncRequests::Discord()->sendMessage( webhookURL, content, username, priority.value_or( ePriority::NORMAL ) );
+		CompletionCallbacks::Register( id, callback );
+		return id;
+	});
+	module.set_function("sendDiscordBatch", []( sol::this_state ts, sol::table batch ) {
+		std::vector<DiscordNotifications::Message> messages;
+		std::vector<sol::optional<sol::protected_function>> callbacks;
+		std::vector<size_t> positions; // Index into batch of every accepted message
+		messages.reserve( batch.size() );
+		callbacks.reserve( batch.size() );
+		positions.reserve( batch.size() );
+		for ( size_t i = 1; i <= batch.size(); ++i ) {
+			sol::optional<sol::table> entry = batch[i];
+			if ( !entry )
+				continue;
+			auto webhookURL = entry->get<sol::optional<std::string_view>>( "webhookURL" );
+			auto content = entry->get<sol::optional<std::string_view>>( "content" );
+			if ( !webhookURL || !content )
+				continue; // Malformed entries get id 0, the rest of the batch still goes out
+			messages.push_back( { *webhookURL, *content, entry->get_or<std::string_view>( "username", {} ), entry->get_or( "priority", ePriority::NORMAL ) } );
+			callbacks.push_back( entry->get<sol::optional<sol::protected_function>>( "callback" ) );
+			positions.push_back( i - 1 );
+		}
+		std::vector<RequestId> ids = AsyncRequests::Discord()->sendMessages( messages );
+		std::vector<RequestId> results( batch.size(), 0 ); // One slot per batch entry, so ids[i] answers batch[i]
+		for ( size_t i = 0; i < ids.size(); ++i ) {
+			CompletionCallbacks::Register( ids[i], callbacks[i] );
+			results[positions[i]] = ids[i];
+		}
+		return sol::as_table( results );
 	});
 }
 
@@ -43,7 +160,7 @@ sol::table open( sol::this_state ThisState ) {
 	module["VERSION"] = 1.0;
 
 	InitializeGameloopHook( module );
-	InitializeCurl( module );
+	InitializeCurl( lua, module );
 	
 	defineTelegramFunctions( lua, module );
 	defineDiscordFunctions( module );
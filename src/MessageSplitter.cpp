@@ -0,0 +1,205 @@
+#include "MessageSplitter.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <cctype>
+
+std::vector<std::string> MessageSplitter::Split( std::string_view text, size_t limit, eMarkup markup ) {
+	std::vector<std::string> chunks;
+	if ( limit == 0 || Utility::CountCodePoints( text ) <= limit ) {
+		chunks.emplace_back( text );
+		return chunks;
+	}
+
+	struct Candidate
+	{
+		size_t Byte = std::string_view::npos;
+		size_t Count = 0;
+		size_t Skip = 0; // Whitespace swallowed by the cut
+	}; // struct Candidate
+
+	State state; // Formatting open at start
+	std::string prefix; // Reopens it in the next chunk
+	size_t start = 0;
+	while ( start < text.size() ) {
+		Candidate newline, space, any;
+		State scan = state;
+		size_t position = start;
+		size_t count = Utility::CountCodePoints( prefix );
+		bool finished = false;
+		for ( ;; ) {
+			if ( position >= text.size() ) {
+				finished = true;
+				break;
+			}
+			if ( count + scan.ClosingLength <= limit && position > start ) {
+				Candidate here{ position, count, 0 };
+				if ( text[position] == '\n' )
+					newline = { position, count, 1 };
+				else if ( text[position] == ' ' )
+					space = { position, count, 1 };
+				any = here;
+			}
+			size_t length = Advance( text, position, markup, scan );
+			size_t units = Utility::CountCodePoints( text.substr( position, length ) );
+			if ( count + units > limit )
+				break;
+			count += units;
+			position += length;
+		}
+		if ( finished && count <= limit ) {
+			chunks.push_back( prefix.append( text.substr( start ) ) );
+			break;
+		}
+
+		// Prefer a line break, then a word break, as long as it keeps the chunk at least half full
+		Candidate cut = any;
+		if ( newline.Byte != std::string_view::npos && newline.Count * 2 >= limit )
+			cut = newline;
+		else if ( space.Byte != std::string_view::npos && space.Count * 2 >= limit )
+			cut = space;
+
+		if ( cut.Byte == std::string_view::npos ) {
+			// A single tag, link or the carried-over formatting does not fit: cut on a code point and drop the formatting
+			size_t end = start;
+			for ( size_t taken = 0; end < text.size() && taken < limit; ++taken )
+				end += CodePointLength( static_cast<unsigned char>( text[end] ) );
+			if ( markup == eMarkup::HTML && end < text.size() ) { // Half a tag or entity gets the whole message rejected
+				for ( char opener : { '<', '&' } ) {
+					size_t open = text.find_last_of( opener, end - 1 );
+					if ( open == std::string_view::npos || open <= start )
+						continue; // Starts the chunk, nothing to back up to
+					size_t close = text.find( opener == '<' ? '>' : ';', open );
+					if ( close != std::string_view::npos && close >= end && ( opener == '<' || close - open <= 10 ) )
+						end = open;
+				}
+			}
+			chunks.emplace_back( text.substr( start, end - start ) );
+			state = State();
+			prefix.clear();
+			start = end;
+			continue;
+		}
+
+		State atCut = state;
+		for ( size_t cursor = start; cursor < cut.Byte; )
+			cursor += Advance( text, cursor, markup, atCut );
+		chunks.push_back( prefix.append( text.substr( start, cut.Byte - start ) ).append( Closing( atCut, markup ) ) );
+		prefix = Opening( atCut );
+		state = std::move( atCut );
+		start = cut.Byte + cut.Skip;
+	}
+	return chunks;
+}
+
+void MessageSplitter::SplitRequest( Request* request, size_t textField, size_t limit, eMarkup markup ) {
+	std::string_view text = request->View( request->Fields[textField].Data );
+	if ( Utility::CountCodePoints( text ) <= limit )
+		return;
+
+	std::vector<std::string> chunks = Split( text, limit, markup );
+	Request* last = request;
+	for ( size_t i = 1; i < chunks.size(); ++i ) {
+		Request* part = request->CloneWithText( chunks[i] ); // Own arena, sized for the chunk
+		last->Next = part;
+		last = part;
+	}
+	request->Replace( request->Fields[textField].Data, chunks[0] );
+}
+
+size_t MessageSplitter::Advance( std::string_view text, size_t position, eMarkup markup, State& state ) {
+	char current = text[position];
+	if ( markup == eMarkup::HTML ) {
+		if ( current == '<' ) {
+			size_t end = text.find( '>', position );
+			if ( end == std::string_view::npos )
+				return 1;
+			std::string_view tag = text.substr( position, end - position + 1 );
+			if ( tag.size() > 2 && tag[1] == '/' ) {
+				std::string_view name = tag.substr( 2, tag.find_first_of( " >", 2 ) - 2 );
+				for ( size_t i = state.Open.size(); i-- > 0; ) {
+					std::string_view open = state.Open[i];
+					if ( open.substr( 1, open.find_first_of( " >", 1 ) - 1 ) == name ) {
+						state.ClosingLength -= name.size() + 3;
+						state.Open.erase( state.Open.begin() + i );
+						break;
+					}
+				}
+			} else if ( tag[tag.size() - 2] != '/' ) {
+				state.ClosingLength += tag.find_first_of( " >", 1 ) - 1 + 3; // "</" name ">"
+				state.Open.push_back( tag );
+			}
+			return tag.size();
+		}
+		if ( current == '&' ) {
+			size_t end = text.find_first_of( "; <&", position + 1 );
+			if ( end != std::string_view::npos && text[end] == ';' && end - position <= 10 )
+				return end - position + 1;
+		}
+	} else if ( markup == eMarkup::MARKDOWN ) {
+		if ( current == '[' ) {
+			size_t label = text.find( "](", position );
+			size_t end = label == std::string_view::npos ? label : text.find( ')', label );
+			if ( end != std::string_view::npos )
+				return end - position + 1;
+		}
+		if ( current == '*' || current == '_' || current == '~' || current == '`' ) {
+			size_t length = 1;
+			while ( position + length < text.size() && text[position + length] == current )
+				++length;
+			std::string_view marker = text.substr( position, length );
+			bool insideCode = !state.Open.empty() && state.Open.back()[0] == '`';
+			bool canOpen = true, canClose = true;
+			if ( current == '*' || current == '_' ) { // Only at word boundaries, snake_case and a*b are plain text
+				char before = position > 0 ? text[position - 1] : ' ';
+				char after = position + length < text.size() ? text[position + length] : ' ';
+				canOpen = !IsWordCharacter( before ) && !IsSpace( after );
+				canClose = !IsSpace( before ) && !IsWordCharacter( after );
+			}
+			if ( canClose && !state.Open.empty() && state.Open.back() == marker ) {
+				state.ClosingLength -= marker.size();
+				state.Open.pop_back();
+			} else if ( canOpen && !insideCode ) {
+				state.ClosingLength += marker.size();
+				state.Open.push_back( marker );
+			}
+			return length;
+		}
+	}
+	return std::min( CodePointLength( static_cast<unsigned char>( current ) ), text.size() - position );
+}
+
+std::string MessageSplitter::Closing( const State& state, eMarkup markup ) {
+	std::string closing;
+	for ( size_t i = state.Open.size(); i-- > 0; ) {
+		std::string_view open = state.Open[i];
+		if ( markup == eMarkup::HTML )
+			closing.append( "</" ).append( open.substr( 1, open.find_first_of( " >", 1 ) - 1 ) ).append( 1, '>' );
+		else
+			closing.append( open );
+	}
+	return closing;
+}
+
+std::string MessageSplitter::Opening( const State& state ) {
+	std::string opening;
+	for ( std::string_view open : state.Open )
+		opening.append( open );
+	return opening;
+}
+
+bool MessageSplitter::IsWordCharacter( char character ) {
+	unsigned char byte = static_cast<unsigned char>( character );
+	return byte >= 0x80 || std::isalnum( byte ); // Any non-ASCII byte belongs to a letter of some script
+}
+
+bool MessageSplitter::IsSpace( char character ) {
+	return std::isspace( static_cast<unsigned char>( character ) ) != 0;
+}
+
+size_t MessageSplitter::CodePointLength( unsigned char lead ) {
+	if ( lead >= 0xF0 ) return 4;
+	if ( lead >= 0xE0 ) return 3;
+	if ( lead >= 0xC0 ) return 2;
+	return 1;
+}
\ No newline at end of file
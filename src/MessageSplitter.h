@@ -0,0 +1,42 @@
+#ifndef _MESSAGE_SPLITTER_H_
+#define _MESSAGE_SPLITTER_H_
+
+#include "Request.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Cuts UTF-8 text into chunks of at most a given number of code points
+// without breaking a code point, an HTML tag or entity, or a Markdown span.
+// Formatting open at a cut is closed at the end of the chunk and reopened
+// at the start of the next one.
+class MessageSplitter
+{
+public:
+	enum class eMarkup
+	{
+		NONE = 0,
+		HTML = 1,
+		MARKDOWN = 2
+	}; // enum class eMarkup
+
+	static std::vector<std::string> Split( std::string_view text, size_t limit, eMarkup markup );
+	// Leaves the first chunk in request->Fields[textField] and chains a copy of the request for each other one
+	static void SplitRequest( Request* request, size_t textField, size_t limit, eMarkup markup );
+private:
+	struct State
+	{
+		std::vector<std::string_view> Open; // Opening tags, or Markdown markers, outermost first
+		size_t ClosingLength = 0; // Code points needed to close everything in Open
+	}; // struct State
+
+	// Consumes the code point or the whole tag, entity, link or marker run at text[position], returns its length in bytes
+	static size_t Advance( std::string_view text, size_t position, eMarkup markup, State& state );
+	static std::string Closing( const State& state, eMarkup markup );
+	static std::string Opening( const State& state );
+	static bool IsWordCharacter( char character );
+	static bool IsSpace( char character );
+	static size_t CodePointLength( unsigned char lead );
+}; // class MessageSplitter
+
+#endif // !_MESSAGE_SPLITTER_H_
\ No newline at end of file
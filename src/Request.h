@@ -0,0 +1,165 @@
+#ifndef _REQUEST_H_
+#define _REQUEST_H_
+
+#include <curl/curl.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+using RequestId = uint32_t; // 0 is never issued and means "not queued"
+
+enum class eProvider
+{
+	NONE = 0,
+	TELEGRAM = 1,
+	DISCORD = 2
+}; // enum class eProvider
+
+enum class ePriority
+{
+	HIGH = 0, // Alerts: admitted first, with a few transfers reserved beyond the in-flight cap
+	NORMAL = 1,
+	LOW = 2 // Bulk uploads: limited number of concurrent transfers
+}; // enum class ePriority
+
+// What the game thread learns about a finished request
+struct Completion
+{
+	RequestId Id = 0;
+	CURLcode Result{ CURLE_OK };
+	long ResponseCode = 0;
+	double LatencyMs = 0.0;
+	long long MessageId = 0; // Telegram's message_id, 0 when absent
+	bool Dropped = false; // Evicted from a full submission queue, never sent
+}; // struct Completion
+
+struct Request
+{
+	static constexpr size_t MAX_FIELDS = 8; // Largest form built is Telegram's media upload with six
+
+	struct Span // Bytes in Arena, always followed by a NUL
+	{
+		uint32_t Offset = 0;
+		uint32_t Length = 0;
+	}; // struct Span
+	struct Field
+	{
+		Span Name;
+		Span Data; // Value, or a file path when MIMEType is set
+		Span MIMEType; // Empty for plain fields
+	}; // struct Field
+	struct Body // Read position of a field streamed to curl straight from Arena
+	{
+		const char* Data{ nullptr };
+		size_t Size = 0;
+		size_t Position = 0;
+	}; // struct Body
+
+	// Description, filled in by the notifiers on the caller's thread
+	RequestId Id = 0;
+	std::chrono::steady_clock::time_point SubmittedAt;
+	eProvider Provider = eProvider::NONE;
+	ePriority Priority = ePriority::NORMAL;
+	std::string Arena; // URL, destination and every field, contiguous, freed with the request
+	Span URL;
+	Span Destination; // Rate-limit key: "botToken/chatId" for Telegram, the webhook URL itself for Discord
+	Field Fields[MAX_FIELDS];
+	size_t FieldCount = 0;
+	int TextField = -1; // Index into Fields of the message text, -1 when there is none
+
+	// Transfer state, owned by the thread driving AsyncRequests
+	CURL* Handle{ nullptr };
+	curl_mime* MIME{ nullptr };
+	Body Bodies[MAX_FIELDS]; // Arena must not change while MIME is alive
+	std::string Response;
+	std::string ResponseHeaders; // Only captured for providers that read them
+	size_t ActiveIndex = 0; // Position in AsyncRequests' active list
+	unsigned Attempts = 0; // Transfers started for this request, retries included
+	bool Admitted = false; // Holds a rate-limit slot from the notifier's Admit, woken from Deferred it starts without another
+	Request* Next{ nullptr }; // Rest of a split message, started once this part is delivered
+
+	// Outcome, filled in by the completion stage
+	CURLcode Result{ CURLE_OK };
+	long ResponseCode = 0;
+
+	std::string_view View( Span span ) const { return std::string_view( Arena.data() + span.Offset, span.Length ); }
+	const char* CString( Span span ) const { return Arena.data() + span.Offset; }
+
+	// The arena keeps the only owned copy of every argument; reserve it up front to allocate once
+	Span Store( std::string_view value ) {
+		Span span{ static_cast<uint32_t>( Arena.size() ), static_cast<uint32_t>( value.size() ) };
+		Arena.append( value ).push_back( '\0' );
+		return span;
+	}
+	// writer appends to the arena directly, so transcoded text needs no temporary
+	template<typename F>
+	Span StoreWith( F&& writer ) {
+		size_t offset = Arena.size();
+		writer( Arena );
+		Span span{ static_cast<uint32_t>( offset ), static_cast<uint32_t>( Arena.size() - offset ) };
+		Arena.push_back( '\0' );
+		return span;
+	}
+	// Grows span in place when it ends the arena, otherwise moves it to the end first
+	void Append( Span& span, std::string_view value ) {
+		if ( span.Offset + span.Length + 1 != Arena.size() ) {
+			Span moved{ static_cast<uint32_t>( Arena.size() ), span.Length };
+			Arena.append( Arena, span.Offset, span.Length ).push_back( '\0' );
+			span = moved;
+		}
+		Arena.pop_back();
+		Arena.append( value ).push_back( '\0' );
+		span.Length += static_cast<uint32_t>( value.size() );
+	}
+	// Rewrites span, reclaiming its bytes when it ends the arena
+	void Replace( Span& span, std::string_view value ) {
+		if ( span.Offset + span.Length + 1 == Arena.size() )
+			Arena.resize( span.Offset );
+		span = Store( value );
+	}
+
+	Field& AddField( std::string_view name, std::string_view data = {} ) {
+		Field& field = Fields[FieldCount++];
+		field.Name = Store( name );
+		field.Data = Store( data );
+		return field;
+	}
+	template<typename F>
+	Field& AddFieldWith( std::string_view name, F&& writer ) {
+		Field& field = Fields[FieldCount++];
+		field.Name = Store( name );
+		field.Data = StoreWith( writer );
+		return field;
+	}
+	Field& AddFile( std::string_view name, std::string_view filePath, std::string_view MIMEType ) {
+		Field& field = AddField( name, filePath );
+		field.MIMEType = Store( MIMEType );
+		return field;
+	}
+	// Fresh request with the same description, the text field replaced by text
+	Request* CloneWithText( std::string_view text ) const {
+		Request* copy = new Request();
+		copy->Provider = Provider;
+		copy->Priority = Priority;
+		copy->TextField = TextField;
+		copy->Arena.reserve( Arena.size() - ( TextField >= 0 ? Fields[TextField].Data.Length : 0 ) + text.size() + 1 );
+		copy->URL = copy->Store( View( URL ) );
+		copy->Destination = Destination.Offset == URL.Offset ? copy->URL : copy->Store( View( Destination ) );
+		for ( size_t i = 0; i < FieldCount; ++i ) {
+			Field& field = copy->Fields[copy->FieldCount++];
+			field.Name = copy->Store( View( Fields[i].Name ) );
+			field.Data = copy->Store( static_cast<int>( i ) == TextField ? text : View( Fields[i].Data ) );
+			field.MIMEType = copy->Store( View( Fields[i].MIMEType ) );
+		}
+		return copy;
+	}
+
+	~Request() {
+		if ( MIME ) curl_mime_free( MIME );
+		if ( Handle ) curl_easy_cleanup( Handle );
+		delete Next;
+	}
+}; // struct Request
+
+#endif // !_REQUEST_H_
\ No newline at end of file
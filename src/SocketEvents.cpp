@@ -0,0 +1,207 @@
+#include "SocketEvents.h"
+#include <algorithm>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined( _WIN32 )
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#define PollSockets WSAPoll
+#define CloseSocket closesocket
+#else
+#define PollSockets poll
+#define CloseSocket close
+#endif
+
+SocketEvents::SocketEvents( CURLM* multiHandle, int* runningHandles ) : MultiHandle( multiHandle ), RunningHandles( runningHandles ) {
+#ifdef __linux__
+	Epoll = epoll_create1( EPOLL_CLOEXEC );
+	WakeFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	if ( Epoll >= 0 && WakeFd >= 0 ) {
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.fd = WakeFd;
+		Ready = epoll_ctl( Epoll, EPOLL_CTL_ADD, WakeFd, &event ) == 0;
+	}
+#elif defined( _WIN32 )
+	// No pipes for WSAPoll: a loopback UDP socket connected to itself carries the wakeups
+	WakeRead = WakeWrite = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+	if ( WakeRead != INVALID_SOCKET ) {
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+		int length = sizeof( address );
+		u_long nonBlocking = 1;
+		Ready = bind( WakeRead, reinterpret_cast<sockaddr*>( &address ), length ) == 0
+			&& getsockname( WakeRead, reinterpret_cast<sockaddr*>( &address ), &length ) == 0
+			&& connect( WakeRead, reinterpret_cast<sockaddr*>( &address ), length ) == 0
+			&& ioctlsocket( WakeRead, FIONBIO, &nonBlocking ) == 0;
+	}
+#else
+	int pipeEnds[2];
+	if ( pipe( pipeEnds ) == 0 ) {
+		WakeRead = pipeEnds[0];
+		WakeWrite = pipeEnds[1];
+		fcntl( WakeRead, F_SETFL, O_NONBLOCK );
+		fcntl( WakeWrite, F_SETFL, O_NONBLOCK );
+		Ready = true;
+	}
+#endif
+#ifndef __linux__
+	Watched.push_back( { WakeRead, POLLIN, 0 } );
+#endif
+	if ( !Ready )
+		return;
+
+	curl_multi_setopt( MultiHandle, CURLMOPT_SOCKETFUNCTION, &SocketEvents::OnSocket );
+	curl_multi_setopt( MultiHandle, CURLMOPT_SOCKETDATA, this );
+	curl_multi_setopt( MultiHandle, CURLMOPT_TIMERFUNCTION, &SocketEvents::OnTimer );
+	curl_multi_setopt( MultiHandle, CURLMOPT_TIMERDATA, this );
+}
+
+SocketEvents::~SocketEvents() {
+	if ( Ready ) { // Transfers still attached may report sockets while the multi handle is torn down
+		curl_multi_setopt( MultiHandle, CURLMOPT_SOCKETFUNCTION, nullptr );
+		curl_multi_setopt( MultiHandle, CURLMOPT_TIMERFUNCTION, nullptr );
+	}
+#ifdef __linux__
+	if ( WakeFd >= 0 )
+		close( WakeFd );
+	if ( Epoll >= 0 )
+		close( Epoll );
+#else
+	if ( WakeRead != CURL_SOCKET_BAD )
+		CloseSocket( WakeRead );
+	if ( WakeWrite != CURL_SOCKET_BAD && WakeWrite != WakeRead )
+		CloseSocket( WakeWrite );
+#endif
+}
+
+void SocketEvents::Run( int timeoutMs ) {
+	Clock::time_point now = Clock::now();
+	if ( TimerDeadline != Clock::time_point::max() ) {
+		auto untilTimer = std::chrono::ceil<std::chrono::milliseconds>( TimerDeadline - now ).count();
+		timeoutMs = static_cast<int>( std::clamp<long long>( untilTimer, 0, timeoutMs ) );
+	}
+
+	Fired.clear();
+#ifdef __linux__
+	epoll_event events[MAX_EVENTS];
+	int count = epoll_wait( Epoll, events, MAX_EVENTS, timeoutMs );
+	for ( int i = 0; i < count; ++i ) {
+		if ( events[i].data.fd == WakeFd ) {
+			eventfd_t value;
+			eventfd_read( WakeFd, &value );
+			continue;
+		}
+		int mask = 0;
+		if ( events[i].events & EPOLLIN ) mask |= CURL_CSELECT_IN;
+		if ( events[i].events & EPOLLOUT ) mask |= CURL_CSELECT_OUT;
+		if ( events[i].events & ( EPOLLERR | EPOLLHUP ) ) mask |= CURL_CSELECT_ERR;
+		curl_socket_t socket = events[i].data.fd; // Copied out of the packed struct
+		Fired.emplace_back( socket, mask );
+	}
+#else
+	for ( pollfd& descriptor : Watched )
+		descriptor.revents = 0;
+	int count = PollSockets( Watched.data(), static_cast<unsigned long>( Watched.size() ), timeoutMs );
+	for ( size_t i = 0; count > 0 && i < Watched.size(); ++i ) {
+		short revents = Watched[i].revents;
+		if ( revents == 0 )
+			continue;
+		--count;
+		if ( i == 0 ) {
+			char drain[64];
+#ifdef _WIN32
+			while ( recv( WakeRead, drain, sizeof( drain ), 0 ) > 0 ) {}
+#else
+			while ( read( WakeRead, drain, sizeof( drain ) ) > 0 ) {}
+#endif
+			continue;
+		}
+		int mask = 0;
+		if ( revents & POLLIN ) mask |= CURL_CSELECT_IN;
+		if ( revents & POLLOUT ) mask |= CURL_CSELECT_OUT;
+		if ( revents & ( POLLERR | POLLHUP | POLLNVAL ) ) mask |= CURL_CSELECT_ERR;
+		Fired.emplace_back( Watched[i].fd, mask );
+	}
+#endif
+
+	// Collected first: curl updates the watch list from inside socket_action
+	for ( auto [socket, mask] : Fired )
+		curl_multi_socket_action( MultiHandle, socket, mask, RunningHandles );
+	if ( TimerDeadline <= Clock::now() ) {
+		TimerDeadline = Clock::time_point::max(); // Cleared first, curl may set a new one right away
+		curl_multi_socket_action( MultiHandle, CURL_SOCKET_TIMEOUT, 0, RunningHandles );
+	}
+}
+
+void SocketEvents::Wakeup() {
+	if ( !Ready )
+		return;
+#ifdef __linux__
+	eventfd_write( WakeFd, 1 );
+#elif defined( _WIN32 )
+	char byte = 0;
+	send( WakeWrite, &byte, 1, 0 );
+#else
+	char byte = 0;
+	(void)write( WakeWrite, &byte, 1 );
+#endif
+}
+
+void SocketEvents::Watch( curl_socket_t socket, int what, bool known ) {
+#ifdef __linux__
+	epoll_event event{};
+	event.events = ( what & CURL_POLL_IN ? EPOLLIN : 0u ) | ( what & CURL_POLL_OUT ? EPOLLOUT : 0u );
+	event.data.fd = socket;
+	epoll_ctl( Epoll, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, socket, &event );
+#else
+	short events = static_cast<short>( ( what & CURL_POLL_IN ? POLLIN : 0 ) | ( what & CURL_POLL_OUT ? POLLOUT : 0 ) );
+	auto position = Positions.find( socket );
+	if ( position != Positions.end() ) {
+		Watched[position->second].events = events;
+	} else {
+		Positions.emplace( socket, Watched.size() );
+		Watched.push_back( { socket, events, 0 } );
+	}
+#endif
+}
+
+void SocketEvents::Forget( curl_socket_t socket ) {
+#ifdef __linux__
+	epoll_ctl( Epoll, EPOLL_CTL_DEL, socket, nullptr ); // Fails harmlessly when curl already closed it
+#else
+	auto position = Positions.find( socket );
+	if ( position == Positions.end() )
+		return;
+	size_t index = position->second; // Swap-remove, never index 0
+	Positions.erase( position );
+	if ( index != Watched.size() - 1 ) {
+		Watched[index] = Watched.back();
+		Positions[Watched[index].fd] = index;
+	}
+	Watched.pop_back();
+#endif
+}
+
+int SocketEvents::OnSocket( CURL* easy, curl_socket_t socket, int what, void* userdata, void* socketdata ) {
+	SocketEvents* events = static_cast<SocketEvents*>( userdata );
+	if ( what == CURL_POLL_REMOVE ) {
+		events->Forget( socket );
+		return 0;
+	}
+	events->Watch( socket, what, socketdata != nullptr );
+	if ( !socketdata )
+		curl_multi_assign( events->MultiHandle, socket, events ); // Any non-null marker: "already registered"
+	return 0;
+}
+
+int SocketEvents::OnTimer( CURLM* multi, long timeoutMs, void* userdata ) {
+	SocketEvents* events = static_cast<SocketEvents*>( userdata );
+	events->TimerDeadline = timeoutMs < 0 ? Clock::time_point::max() : Clock::now() + std::chrono::milliseconds( timeoutMs );
+	return 0;
+}
\ No newline at end of file
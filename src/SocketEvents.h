@@ -0,0 +1,60 @@
+#ifndef _SOCKET_EVENTS_H_
+#define _SOCKET_EVENTS_H_
+
+#include <curl/curl.h>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#ifdef __linux__
+#include <sys/epoll.h>
+#elif defined( _WIN32 )
+#include <winsock2.h>
+#else
+#include <poll.h>
+#endif
+
+// Event-driven alternative to curl_multi_perform: curl reports which
+// sockets it wants watched and when its next timeout is, and only the
+// sockets that became ready are handed back through
+// curl_multi_socket_action. Uses epoll on Linux, poll (WSAPoll on
+// Windows) elsewhere. Owned by the thread driving the multi handle,
+// except Wakeup, which is safe from any thread.
+// Before Windows 10 2004, WSAPoll never reports a failed connect, so a
+// refused connection only surfaces at the connect timeout in this mode.
+class SocketEvents
+{
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr int MAX_EVENTS = 64; // Per wait; more stay ready for the next one
+
+	CURLM* MultiHandle;
+	int* RunningHandles;
+	Clock::time_point TimerDeadline = Clock::time_point::max(); // From CURLMOPT_TIMERFUNCTION
+	bool Ready = false; // Both halves of the wakeup channel exist
+#ifdef __linux__
+	int Epoll = -1;
+	int WakeFd = -1; // eventfd
+#else
+	std::vector<pollfd> Watched; // Handed to poll as is; Watched[0] is the wakeup socket
+	std::unordered_map<curl_socket_t, size_t> Positions; // Socket -> index into Watched
+	curl_socket_t WakeRead = CURL_SOCKET_BAD;
+	curl_socket_t WakeWrite = CURL_SOCKET_BAD;
+#endif
+	std::vector<std::pair<curl_socket_t, int>> Fired; // Reused by Run
+public:
+	SocketEvents( CURLM* multiHandle, int* runningHandles );
+	~SocketEvents();
+
+	bool Valid() const { return Ready; }
+	// Waits up to timeoutMs, or until curl's own timer or Wakeup, then lets curl act on what fired
+	void Run( int timeoutMs );
+	void Wakeup();
+private:
+	void Watch( curl_socket_t socket, int what, bool known );
+	void Forget( curl_socket_t socket );
+
+	static int OnSocket( CURL* easy, curl_socket_t socket, int what, void* userdata, void* socketdata );
+	static int OnTimer( CURLM* multi, long timeoutMs, void* userdata );
+}; // class SocketEvents
+
+#endif // !_SOCKET_EVENTS_H_
\ No newline at end of file
@@ -0,0 +1,212 @@
+#include "Spool.h"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+Spool::~Spool() {
+	if ( File ) {
+		fflush( File );
+		SyncToDisk( File );
+		fclose( File );
+	}
+}
+
+bool Spool::Open( const std::string& path, Clock::duration syncInterval, std::vector<Request*>& pending ) {
+	Path = path;
+	SyncInterval = syncInterval;
+	LastSync = Clock::now();
+
+	std::ifstream previous( path, std::ios::binary );
+	std::string journal( ( std::istreambuf_iterator<char>( previous ) ), std::istreambuf_iterator<char>() );
+	previous.close();
+
+	std::vector<Request*> replay;
+	std::unordered_map<RequestId, size_t> positions; // Id -> index into replay
+	std::string_view in = journal;
+	uint32_t length = 0;
+	while ( GetInteger( in, length ) && length <= in.size() ) { // A torn last record ends the replay
+		std::string_view record = in.substr( 0, length );
+		in.remove_prefix( length );
+		uint32_t type = 0;
+		uint32_t id = 0;
+		if ( !GetInteger( record, type ) || !GetInteger( record, id ) )
+			continue;
+		if ( type == static_cast<uint32_t>( eRecord::REQUEST ) ) {
+			if ( Request* request = ReadRequest( record ) ) {
+				positions[id] = replay.size();
+				replay.push_back( request );
+			}
+		} else if ( type == static_cast<uint32_t>( eRecord::DONE ) ) {
+			auto position = positions.find( id );
+			if ( position != positions.end() ) {
+				delete replay[position->second];
+				replay[position->second] = nullptr;
+				positions.erase( position );
+			}
+		}
+	}
+	for ( Request* request : replay )
+		if ( request )
+			pending.push_back( request );
+
+	File = fopen( ( path + ".new" ).c_str(), "wb" );
+	return File != nullptr;
+}
+
+void Spool::Commit() {
+	std::lock_guard<std::mutex> lock( Lock );
+	if ( !File )
+		return;
+	fflush( File );
+	SyncToDisk( File );
+	fclose( File );
+	std::error_code error;
+	std::filesystem::rename( Path + ".new", Path, error ); // Replaces the old journal in one step
+	File = fopen( error ? ( Path + ".new" ).c_str() : Path.c_str(), "ab" );
+	Dirty = false;
+}
+
+void Spool::Record( const Request& request ) {
+	if ( !File ) // Only changes while AsyncRequests is being set up
+		return;
+	std::string record;
+	PutInteger( record, static_cast<uint32_t>( eRecord::REQUEST ) );
+	PutInteger( record, request.Id );
+	PutInteger( record, static_cast<uint32_t>( request.Provider ) );
+	PutInteger( record, static_cast<uint32_t>( request.Priority ) );
+	PutInteger( record, static_cast<uint32_t>( request.TextField ) );
+	PutString( record, request.View( request.Destination ) );
+	PutString( record, request.View( request.URL ) );
+	uint32_t parts = 0;
+	for ( const Request* part = &request; part; part = part->Next )
+		++parts;
+	PutInteger( record, parts );
+	for ( const Request* part = &request; part; part = part->Next ) { // Split messages are replayed whole
+		PutInteger( record, static_cast<uint32_t>( part->FieldCount ) );
+		for ( size_t i = 0; i < part->FieldCount; ++i ) {
+			const Request::Field& field = part->Fields[i];
+			PutString( record, part->View( field.Name ) );
+			PutString( record, part->View( field.Data ) );
+			PutString( record, part->View( field.MIMEType ) );
+		}
+	}
+	Append( record );
+}
+
+void Spool::Complete( RequestId id ) {
+	if ( !File )
+		return;
+	std::string record;
+	PutInteger( record, static_cast<uint32_t>( eRecord::DONE ) );
+	PutInteger( record, id );
+	Append( record );
+}
+
+void Spool::Sync( Clock::time_point now, bool force ) {
+	FILE* file{ nullptr };
+	{
+		std::lock_guard<std::mutex> lock( Lock );
+		if ( !File || !Dirty || ( !force && now - LastSync < SyncInterval ) )
+			return;
+		fflush( File );
+		Dirty = false;
+		LastSync = now;
+		file = File;
+	}
+	SyncToDisk( file ); // Unlocked, so the game thread can keep appending meanwhile
+}
+
+void Spool::Append( const std::string& record ) {
+	std::string framed;
+	framed.reserve( 4 + record.size() );
+	PutInteger( framed, static_cast<uint32_t>( record.size() ) );
+	framed.append( record );
+
+	std::lock_guard<std::mutex> lock( Lock );
+	if ( !File )
+		return;
+	fwrite( framed.data(), 1, framed.size(), File );
+	Dirty = true;
+}
+
+void Spool::SyncToDisk( FILE* file ) {
+#ifdef _WIN32
+	_commit( _fileno( file ) );
+#else
+	fsync( fileno( file ) );
+#endif
+}
+
+void Spool::PutInteger( std::string& out, uint32_t value ) {
+	for ( int shift = 0; shift < 32; shift += 8 )
+		out.push_back( static_cast<char>( ( value >> shift ) & 0xFF ) );
+}
+
+void Spool::PutString( std::string& out, std::string_view value ) {
+	PutInteger( out, static_cast<uint32_t>( value.size() ) );
+	out.append( value );
+}
+
+bool Spool::GetInteger( std::string_view& in, uint32_t& value ) {
+	if ( in.size() < 4 )
+		return false;
+	value = 0;
+	for ( int i = 0; i < 4; ++i )
+		value |= static_cast<uint32_t>( static_cast<unsigned char>( in[i] ) ) << ( i * 8 );
+	in.remove_prefix( 4 );
+	return true;
+}
+
+bool Spool::GetString( std::string_view& in, std::string_view& value ) {
+	uint32_t length = 0;
+	if ( !GetInteger( in, length ) || length > in.size() )
+		return false;
+	value = in.substr( 0, length );
+	in.remove_prefix( length );
+	return true;
+}
+
+Request* Spool::ReadRequest( std::string_view in ) {
+	uint32_t provider = 0, priority = 0, textField = 0, parts = 0;
+	std::string_view destination, URL;
+	if ( !GetInteger( in, provider ) || !GetInteger( in, priority ) || !GetInteger( in, textField )
+		|| !GetString( in, destination ) || !GetString( in, URL ) || !GetInteger( in, parts ) || parts == 0 )
+		return nullptr;
+	int text = static_cast<int>( textField ); // -1 is stored as all ones
+	if ( ( provider != static_cast<uint32_t>( eProvider::TELEGRAM ) && provider != static_cast<uint32_t>( eProvider::DISCORD ) )
+		|| priority > static_cast<uint32_t>( ePriority::LOW ) || text < -1 )
+		return nullptr; // Indexes Waiting and Fields once replayed
+
+	Request* head{ nullptr };
+	Request** link = &head;
+	for ( uint32_t part = 0; part < parts; ++part ) {
+		uint32_t fields = 0;
+		if ( !GetInteger( in, fields ) || fields > Request::MAX_FIELDS || text >= static_cast<int>( fields ) ) {
+			delete head;
+			return nullptr;
+		}
+		Request* request = *link = new Request();
+		link = &request->Next;
+		request->Provider = static_cast<eProvider>( provider );
+		request->Priority = static_cast<ePriority>( priority );
+		request->TextField = text;
+		request->Arena.reserve( in.size() ); // Never more than what is left of the record
+		request->URL = request->Store( URL );
+		request->Destination = destination == URL ? request->URL : request->Store( destination );
+		for ( uint32_t i = 0; i < fields; ++i ) {
+			std::string_view name, data, MIMEType;
+			if ( !GetString( in, name ) || !GetString( in, data ) || !GetString( in, MIMEType ) ) {
+				delete head;
+				return nullptr;
+			}
+			request->AddField( name, data ).MIMEType = request->Store( MIMEType );
+		}
+	}
+	return head;
+}
\ No newline at end of file
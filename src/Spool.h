@@ -0,0 +1,56 @@
+#ifndef _SPOOL_H_
+#define _SPOOL_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Request.h"
+
+// Append-only journal of accepted requests so they survive UnLoad and
+// restarts. Every record is a little-endian uint32 length followed by that
+// many bytes: a REQUEST record with the whole description, or a DONE
+// tombstone with just the id. The file is synced to disk in batches.
+class Spool
+{
+	using Clock = std::chrono::steady_clock;
+
+	enum class eRecord
+	{
+		REQUEST = 1,
+		DONE = 2
+	}; // enum class eRecord
+
+	std::mutex Lock; // Records come from the game thread, tombstones from the thread driving curl
+	FILE* File{ nullptr };
+	std::string Path;
+	bool Dirty = false;
+	Clock::time_point LastSync;
+	Clock::duration SyncInterval = Clock::duration::zero();
+public:
+	~Spool();
+
+	// Reads what the last session left unfinished into pending and starts a new journal
+	// next to the old one; Commit replaces the old one once pending was recorded again
+	bool Open( const std::string& path, Clock::duration syncInterval, std::vector<Request*>& pending );
+	void Commit();
+
+	// Both are no-ops without an open journal
+	void Record( const Request& request );
+	void Complete( RequestId id );
+	void Sync( Clock::time_point now, bool force = false );
+private:
+	void Append( const std::string& record );
+	static void SyncToDisk( FILE* file ); // fsync, or _commit on Windows
+
+	static void PutInteger( std::string& out, uint32_t value );
+	static void PutString( std::string& out, std::string_view value );
+	static bool GetInteger( std::string_view& in, uint32_t& value );
+	static bool GetString( std::string_view& in, std::string_view& value ); // value points into in's buffer
+	static Request* ReadRequest( std::string_view in );
+}; // class Spool
+
+#endif // !_SPOOL_H_
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef _SUBMISSION_QUEUE_H_
+#define _SUBMISSION_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free ring (Vyukov). Any number of producers may push; the
+// transfer engine is the single regular consumer, but TryPop is safe from
+// producers too, which the drop-oldest overflow policy relies on.
+template<typename T>
+class SubmissionQueue
+{
+	struct Cell
+	{
+		std::atomic<size_t> Sequence;
+		T Value;
+	}; // struct Cell
+
+	static constexpr size_t CACHE_LINE = 64;
+
+	std::unique_ptr<Cell[]> Cells;
+	size_t Mask;
+
+	alignas( CACHE_LINE ) std::atomic<size_t> Head{ 0 }; // Next cell to pop
+	alignas( CACHE_LINE ) std::atomic<size_t> Tail{ 0 }; // Next cell to push
+public:
+	explicit SubmissionQueue( size_t capacity ) {
+		size_t size = 2;
+		while ( size < capacity )
+			size <<= 1;
+		Cells.reset( new Cell[size] );
+		Mask = size - 1;
+		for ( size_t i = 0; i < size; ++i )
+			Cells[i].Sequence.store( i, std::memory_order_relaxed );
+	}
+
+	SubmissionQueue( const SubmissionQueue& ) = delete;
+	SubmissionQueue& operator=( const SubmissionQueue& ) = delete;
+
+	size_t Capacity() const { return Mask + 1; }
+
+	bool TryPush( T value ) {
+		size_t position = Tail.load( std::memory_order_relaxed );
+		for ( ;; ) {
+			Cell& cell = Cells[position & Mask];
+			size_t sequence = cell.Sequence.load( std::memory_order_acquire );
+			intptr_t difference = static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( position );
+			if ( difference == 0 ) {
+				if ( Tail.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) ) {
+					cell.Value = value;
+					cell.Sequence.store( position + 1, std::memory_order_release );
+					return true;
+				}
+			} else if ( difference < 0 ) {
+				return false; // Full
+			} else {
+				position = Tail.load( std::memory_order_relaxed );
+			}
+		}
+	}
+
+	bool TryPop( T& value ) {
+		size_t position = Head.load( std::memory_order_relaxed );
+		for ( ;; ) {
+			Cell& cell = Cells[position & Mask];
+			size_t sequence = cell.Sequence.load( std::memory_order_acquire );
+			intptr_t difference = static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( position + 1 );
+			if ( difference == 0 ) {
+				if ( Head.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) ) {
+					value = cell.Value;
+					cell.Sequence.store( position + Mask + 1, std::memory_order_release );
+					return true;
+				}
+			} else if ( difference < 0 ) {
+				return false; // Empty
+			} else {
+				position = Head.load( std::memory_order_relaxed );
+			}
+		}
+	}
+}; // class SubmissionQueue
+
+#endif // !_SUBMISSION_QUEUE_H_
\ No newline at end of file
@@ -1,181 +1,155 @@
 #include "TelegramNotifications.h"
+#include "AsyncRequests.h"
+#include "MessageSplitter.h"
 #include "Utility.h"
-#include <curl/mprintf.h>
-#include <curl/multi.h>
 
-TelegramNotifications::TelegramNotifications( CURLM* multihandle_ ) : MultiHandle( multihandle_ ) { }
-
-void TelegramNotifications::sendMessage( std::string botToken, std::string chatId, std::string text, eParseMode parseMode, bool disableNotification, bool protectContent ) {
-#pragma warning( push )
-#pragma warning( disable : 26812)
-
-	CURL* cURL = curl_easy_init();
-	struct curl_slist* Headers{ nullptr };
-	curl_mime* MIME{ nullptr };
-	curl_mimepart* MIMEPart{ nullptr };
-	char* URL = new char[128];
-
-	if ( cURL ) {
-		curl_msprintf( URL, "https://api.telegram.org/bot%s/%s", botToken.data(), "sendMessage" ); // Create API URL
-
-		curl_easy_setopt( cURL, CURLOPT_POST, 1 ); // Request Method
-		curl_easy_setopt( cURL, CURLOPT_URL, URL ); // Request URL
-		curl_easy_setopt( cURL, CURLOPT_DEFAULT_PROTOCOL, "https" ); // Request Protocol
-
-		curl_easy_setopt( cURL, CURLOPT_HTTPHEADER, Headers ); // Installing Headers
-
-		curl_slist_append( Headers, "Content-Type: multipart/form-data" ); // Header -> Content-Type
-		curl_slist_append( Headers, "charset=utf-8" ); // Header -> Charset
-
-		MIME = curl_mime_init( cURL ); // Initialize MultipurposeInternetMailExtensions
-
-		MIMEPart = curl_mime_addpart( MIME ); // First MIME's Part
-		curl_mime_name( MIMEPart, "chat_id" );
-		curl_mime_data( MIMEPart, chatId.c_str(), CURL_ZERO_TERMINATED );
-
-		MIMEPart = curl_mime_addpart( MIME ); // Second MIME's Part
-		curl_mime_name( MIMEPart, "text" );
-		curl_mime_data( MIMEPart, Utility::win1251ToUTF8( text.c_str() ).c_str(), CURL_ZERO_TERMINATED );
-
-		MIMEPart = curl_mime_addpart( MIME ); // Third MIME's Part
-		curl_mime_name( MIMEPart, "parse_mode" );
-		curl_mime_data( MIMEPart, GetNameOfParseMode( parseMode ).c_str(), CURL_ZERO_TERMINATED );
-
-		if ( disableNotification ) {
-			MIMEPart = curl_mime_addpart( MIME ); // Fourth MIME's Part
-			curl_mime_name( MIMEPart, "disable_notification" );
-			curl_mime_data( MIMEPart, "true", CURL_ZERO_TERMINATED );
-		}
-
-		if ( protectContent ) {
-			MIMEPart = curl_mime_addpart( MIME ); // Fifth MIME's Part
-			curl_mime_name( MIMEPart, "protect_content" );
-			curl_mime_data( MIMEPart, "true", CURL_ZERO_TERMINATED );
-		}
-
-		curl_easy_setopt( cURL, CURLOPT_MIMEPOST, MIME ); // Install MIME
-
-		curl_multi_add_handle( MultiHandle, cURL ); // Runing
+RequestId TelegramNotifications::sendMessage( std::string_view botToken, std::string_view chatId, std::string_view text, eParseMode parseMode, bool disableNotification, bool protectContent, ePriority priority ) {
+	return Send( { botToken, chatId, text, parseMode, disableNotification, protectContent, priority } ); // Runing
+}
+std::vector<RequestId> TelegramNotifications::sendMessages( const std::vector<Message>& messages ) {
+	if ( Coalesce.Enabled() || AsyncRequests::Deduplicating() ) {
+		std::vector<RequestId> ids;
+		ids.reserve( messages.size() );
+		for ( const Message& message : messages )
+			ids.push_back( Send( message ) );
+		return ids;
 	}
-
-#pragma warning( pop )
+	std::vector<Request*> requests;
+	requests.reserve( messages.size() );
+	for ( const Message& message : messages )
+		requests.push_back( CreateMessage( message ) );
+	return AsyncRequests::Submit( requests );
+}
+RequestId TelegramNotifications::sendMedia( eFileType fileType, std::string_view botToken, std::string_view chatId, std::string_view filePath, std::string_view caption, eParseMode parseMode, bool disableNotification, bool protectContent, ePriority priority ) {
+	MediaInfo media = GetMediaInfo( fileType );
+	Request* request = new Request();
+	request->Provider = eProvider::TELEGRAM;
+	request->Priority = priority;
+	request->Arena.reserve( ARENA_OVERHEAD + 2 * ( botToken.size() + chatId.size() ) + filePath.size() + caption.size() * Utility::MAX_UTF8_RATIO ); // Token and chat id twice: URL or field, and destination
+	SetAPIURL( request, botToken, media.Method ); // Create API URL
+	SetDestination( request, botToken, chatId );
+
+	request->AddField( "chat_id", chatId );
+	request->AddFile( media.Argument, filePath, media.MIMEType );
+	request->AddFieldWith( "caption", [caption]( std::string& arena ) { Utility::win1251ToUTF8( caption, arena ); } );
+	request->AddField( "parse_mode", GetNameOfParseMode( parseMode ) );
+	if ( disableNotification )
+		request->AddField( "disable_notification", "true" );
+	if ( protectContent )
+		request->AddField( "protect_content", "true" );
+
+	return AsyncRequests::Submit( request ); // Runing
 }
-void TelegramNotifications::sendMedia( eFileType fileType, std::string botToken, std::string chatId, std::string filePath, std::string caption, eParseMode parseMode, bool disableNotification, bool protectContent ) {
-#pragma warning( push )
-#pragma warning( disable : 26812)
-	auto [telegramMethod, telegramArgument, MIMEType] = GetMediaInfo( fileType );
-	CURL* cURL = curl_easy_init();
-	struct curl_slist* Headers{ nullptr };
-	curl_mime* MIME{ nullptr };
-	curl_mimepart* MIMEPart{ nullptr };
-	char* URL = new char[128];
-
-	if ( cURL ) {
-		curl_msprintf( URL, "https://api.telegram.org/bot%s/%s", botToken.data(), telegramMethod.data() ); // Create API URL
-
-		curl_easy_setopt( cURL, CURLOPT_POST, 1 ); // Request Method
-		curl_easy_setopt( cURL, CURLOPT_URL, URL ); // Request URL
-		curl_easy_setopt( cURL, CURLOPT_DEFAULT_PROTOCOL, "https" ); // Request Protocol
-
-		curl_easy_setopt( cURL, CURLOPT_HTTPHEADER, Headers ); // Installing Headers
-
-		curl_slist_append( Headers, "Content-Type: multipart/form-data" ); // Header -> Content-Type
-		curl_slist_append( Headers, "charset=utf-8" ); // Header -> Charset
-
-		MIME = curl_mime_init( cURL ); // Initialize MultipurposeInternetMailExtensions
-		
-		MIMEPart = curl_mime_addpart( MIME ); // First MIME's Part
-		curl_mime_name( MIMEPart, "chat_id" );
-		curl_mime_data( MIMEPart, chatId.c_str(), CURL_ZERO_TERMINATED );
 
-		MIMEPart = curl_mime_addpart( MIME ); // Second MIME's Part
-		curl_mime_name( MIMEPart, telegramArgument.c_str() );
-		curl_mime_filedata( MIMEPart, filePath.c_str() );
-		curl_mime_type( MIMEPart, MIMEType.c_str() );
+std::chrono::steady_clock::duration TelegramNotifications::Admit( Request& request, std::chrono::steady_clock::time_point now ) {
+	std::string_view destination = request.View( request.Destination );
 
-		MIMEPart = curl_mime_addpart( MIME ); // Third MIME's Part
-		curl_mime_name( MIMEPart, "caption" );
-		curl_mime_data( MIMEPart, Utility::win1251ToUTF8( caption.c_str() ).c_str(), CURL_ZERO_TERMINATED );
+	PruneBuckets( now );
+	Key.assign( destination.substr( 0, destination.find( '/' ) ) ); // Bot token
+	TokenBucket& bot = BotBuckets.try_emplace( Key, BOT_RATE, BOT_RATE, now ).first->second;
+	Key.assign( destination );
+	TokenBucket& chat = ChatBuckets.try_emplace( Key, CHAT_RATE, CHAT_BURST, now ).first->second;
 
-		MIMEPart = curl_mime_addpart( MIME ); // Fourth MIME's Part
-		curl_mime_name( MIMEPart, "parse_mode" );
-		curl_mime_data( MIMEPart, GetNameOfParseMode( parseMode ).c_str(), CURL_ZERO_TERMINATED );
+	if ( request.Admitted && chat.BlockedUntil <= now )
+		return std::chrono::steady_clock::duration::zero(); // Woken at the slot it reserved
+	request.Admitted = true; // A fresh request, or a 429 voided its slot: reserve one behind everyone already waiting
+	return std::max( bot.Reserve( now ), chat.Reserve( now ) );
+}
 
-		if ( disableNotification ) {
-			MIMEPart = curl_mime_addpart( MIME ); // Fifth MIME's Part
-			curl_mime_name( MIMEPart, "disable_notification" );
-			curl_mime_data( MIMEPart, "true", CURL_ZERO_TERMINATED );
-		}
+std::chrono::steady_clock::duration TelegramNotifications::RetryAfter( const Request& request, std::chrono::steady_clock::time_point now ) {
+	if ( request.ResponseCode != 429 )
+		return std::chrono::steady_clock::duration::zero();
+
+	// {"ok":false,"error_code":429,...,"parameters":{"retry_after":5}}
+	auto delay = std::chrono::seconds( std::max( 1ll, Utility::FindJSONInteger( request.Response, "retry_after", 1 ) ) );
+	Key.assign( request.View( request.Destination ) );
+	auto chat = ChatBuckets.find( Key );
+	if ( chat != ChatBuckets.end() )
+		chat->second.Block( now + delay ); // Hold the rest of this chat's queue too
+	return delay;
+}
 
-		if ( protectContent ) {
-			MIMEPart = curl_mime_addpart( MIME ); // Sixth MIME's Part
-			curl_mime_name( MIMEPart, "protect_content" );
-			curl_mime_data( MIMEPart, "true", CURL_ZERO_TERMINATED );
+void TelegramNotifications::PruneBuckets( std::chrono::steady_clock::time_point now ) {
+	if ( now < NextPrune || BotBuckets.size() + ChatBuckets.size() < MAX_IDLE_BUCKETS )
+		return;
+	NextPrune = now + PRUNE_INTERVAL; // A broadcast to thousands of chats must not rescan the maps on every Admit
+	for ( auto* buckets : { &BotBuckets, &ChatBuckets } ) {
+		for ( auto bucket = buckets->begin(); bucket != buckets->end(); ) {
+			if ( bucket->second.Idle( now ) )
+				bucket = buckets->erase( bucket );
+			else
+				++bucket;
 		}
-
-		curl_easy_setopt( cURL, CURLOPT_MIMEPOST, MIME ); // Install MIME
-
-		curl_multi_add_handle( MultiHandle, cURL ); // Runing
-
 	}
+}
 
-#pragma warning( pop )
+RequestId TelegramNotifications::Send( const Message& message ) {
+	Request* request = CreateMessage( message );
+	if ( RequestId repeat = AsyncRequests::Deduplicate( request, MAX_CHARACTER ) )
+		return repeat; // Counted into a later summary instead of sent
+	if ( !Coalesce.Enabled() || message.Priority == ePriority::HIGH ) // Alerts never wait for a window
+		return AsyncRequests::Submit( request );
+
+	// Only messages that would look the same once sent can share a request
+	std::string key( request->View( request->Destination ) );
+	key.append( 1, '\0' ).append( 1, static_cast<char>( '0' + static_cast<int>( message.ParseMode ) ) );
+	key.append( 1, message.DisableNotification ? '1' : '0' ).append( 1, message.ProtectContent ? '1' : '0' );
+	key.append( 1, static_cast<char>( '0' + static_cast<int>( message.Priority ) ) );
+	return Coalesce.Add( std::move( key ), request );
 }
 
-std::string TelegramNotifications::GetNameOfParseMode( eParseMode ParseMode ) {
-	std::string result = "Nothing";
+Request* TelegramNotifications::CreateMessage( const Message& message ) {
+	Request* request = new Request();
+	request->Provider = eProvider::TELEGRAM;
+	request->Priority = message.Priority;
+	request->Arena.reserve( ARENA_OVERHEAD + 2 * ( message.BotToken.size() + message.ChatId.size() ) + message.Text.size() * Utility::MAX_UTF8_RATIO );
+	SetAPIURL( request, message.BotToken, "sendMessage" ); // Create API URL
+	SetDestination( request, message.BotToken, message.ChatId );
+
+	request->AddField( "chat_id", message.ChatId );
+	request->AddField( "parse_mode", GetNameOfParseMode( message.ParseMode ) );
+	if ( message.DisableNotification )
+		request->AddField( "disable_notification", "true" );
+	if ( message.ProtectContent )
+		request->AddField( "protect_content", "true" );
+	request->AddFieldWith( "text", [&message]( std::string& arena ) { Utility::win1251ToUTF8( message.Text, arena ); } );
+	request->TextField = static_cast<int>( request->FieldCount - 1 ); // Last in the arena, so merged texts grow in place
+
+	MessageSplitter::eMarkup markup = message.ParseMode == eParseMode::MARKDOWN ? MessageSplitter::eMarkup::MARKDOWN : MessageSplitter::eMarkup::HTML;
+	MessageSplitter::SplitRequest( request, request->TextField, MAX_CHARACTER, markup ); // Longer texts are rejected by the API
+	return request;
+}
+
+void TelegramNotifications::SetAPIURL( Request* request, std::string_view botToken, std::string_view method ) {
+	static constexpr std::string_view API = "https://api.telegram.org/bot";
+	request->URL = request->StoreWith( [&]( std::string& arena ) { arena.append( API ).append( botToken ).append( 1, '/' ).append( method ); } );
+}
+void TelegramNotifications::SetDestination( Request* request, std::string_view botToken, std::string_view chatId ) {
+	request->Destination = request->StoreWith( [&]( std::string& arena ) { arena.append( botToken ).append( 1, '/' ).append( chatId ); } );
+}
+std::string_view TelegramNotifications::GetNameOfParseMode( eParseMode ParseMode ) {
 	switch ( ParseMode ) {
-		case ( eParseMode::HTML ): {
-			result = "HTML";
-			break;
-		}
 		case ( eParseMode::MARKDOWN ): {
-			result = "Markdown";
-			break;
+			return "Markdown";
 		}
 		default: {
-			result = "HTML";
-			break;
+			return "HTML";
 		}
 	}
-	return result;
 }
-std::tuple<std::string, std::string, std::string> TelegramNotifications::GetMediaInfo( eFileType fileType ) {
-	std::string telegramMethod = "sendPhoto";
-	std::string telegramArgument = "photo";
-	std::string MIMEType = "image";
-
+TelegramNotifications::MediaInfo TelegramNotifications::GetMediaInfo( eFileType fileType ) {
 	switch ( fileType ) {
-		case ( eFileType::PHOTO ): {
-			telegramMethod = "sendPhoto";
-			telegramArgument = "photo";
-			MIMEType = "image";
-			break;
-		}
 		case ( eFileType::AUDIO ): {
-			telegramMethod = "sendAudio";
-			telegramArgument = "audio";
-			MIMEType = "audio";
-			break;
+			return { "sendAudio", "audio", "audio" };
 		}
 		case ( eFileType::DOCUMENT ): {
-			telegramMethod = "sendDocument";
-			telegramArgument = "document";
-			MIMEType = "application";
-			break;
+			return { "sendDocument", "document", "application" };
 		}
 		case ( eFileType::VIDEO ): {
-			telegramMethod = "sendVideo";
-			telegramArgument = "video";
-			MIMEType = "video";
-			break;
+			return { "sendVideo", "video", "video" };
 		}
 		default: {
-			telegramMethod = "sendPhoto";
-			telegramArgument = "photo";
-			MIMEType = "image";
-			break;
+			return { "sendPhoto", "photo", "image" };
 		}
 	}
-	return std::make_tuple( telegramMethod, telegramArgument, MIMEType );
 }
\ No newline at end of file
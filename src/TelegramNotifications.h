@@ -2,15 +2,43 @@
 #define _TELEGRAM_NOTIFICATIONS_H_
 
 #include <curl/curl.h>
+#include <chrono>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Coalescer.h"
+#include "Request.h"
+#include "TokenBucket.h"
 
 class TelegramNotifications
 {
 	static constexpr int MAX_CHARACTER = 4096;
 
-	CURLM* MultiHandle;
+	// Bot API limits: about 30 messages per second per bot, 1 per second per chat
+	static constexpr double BOT_RATE = 30.0;
+	static constexpr double CHAT_RATE = 1.0;
+	static constexpr double CHAT_BURST = 3.0;
+	static constexpr size_t MAX_IDLE_BUCKETS = 1024;
+	static constexpr std::chrono::seconds PRUNE_INTERVAL{ 10 };
+	static constexpr size_t ARENA_OVERHEAD = 192; // API URL, field names and fixed values of the largest request
+
+	struct MediaInfo
+	{
+		std::string_view Method;
+		std::string_view Argument;
+		std::string_view MIMEType;
+	}; // struct MediaInfo
+
+	// Touched only by the thread driving AsyncRequests
+	std::unordered_map<std::string, TokenBucket> BotBuckets;
+	std::unordered_map<std::string, TokenBucket> ChatBuckets;
+	std::chrono::steady_clock::time_point NextPrune; // Idle buckets are swept at most once per PRUNE_INTERVAL
+	std::string Key; // Reused for bucket lookups, so Admit does not allocate
+
+	Coalescer Coalesce{ MAX_CHARACTER }; // Game thread only
 public:
-	TelegramNotifications( CURLM* multihandle_ );
+	TelegramNotifications() {};
 	~TelegramNotifications() {  };
 
 	enum class eParseMode
@@ -25,11 +53,34 @@ public:
 		DOCUMENT = 2,
 		VIDEO = 3
 	}; // enum class eFileType
-	void sendMessage( std::string botToken, std::string chatId, std::string text, eParseMode parseMode, bool disableNotification, bool protectContent );
-	void sendMedia( eFileType fileType, std::string botToken, std::string chatId, std::string filePath, std::string caption, eParseMode parseMode, bool disableNotification, bool protectContent );
+	struct Message
+	{
+		std::string_view BotToken;
+		std::string_view ChatId;
+		std::string_view Text;
+		eParseMode ParseMode = eParseMode::HTML;
+		bool DisableNotification = false;
+		bool ProtectContent = false;
+		ePriority Priority = ePriority::NORMAL;
+	}; // struct Message
+	RequestId sendMessage( std::string_view botToken, std::string_view chatId, std::string_view text, eParseMode parseMode, bool disableNotification, bool protectContent, ePriority priority );
+	std::vector<RequestId> sendMessages( const std::vector<Message>& messages );
+
+	void SetCoalesceWindow( std::chrono::steady_clock::duration window ) { Coalesce.SetWindow( window ); }
+	size_t FlushCoalesced( std::chrono::steady_clock::time_point now, bool everything = false ) { return Coalesce.Flush( now, everything ); }
+	RequestId sendMedia( eFileType fileType, std::string_view botToken, std::string_view chatId, std::string_view filePath, std::string_view caption, eParseMode parseMode, bool disableNotification, bool protectContent, ePriority priority );
+
+	// Engine hooks: how long a request must wait before starting, and how long to defer it after a response
+	std::chrono::steady_clock::duration Admit( Request& request, std::chrono::steady_clock::time_point now );
+	std::chrono::steady_clock::duration RetryAfter( const Request& request, std::chrono::steady_clock::time_point now );
 private:
-	std::string GetNameOfParseMode( eParseMode ParseMode );
-	std::tuple<std::string, std::string, std::string> GetMediaInfo( eFileType fileType );
+	Request* CreateMessage( const Message& message );
+	RequestId Send( const Message& message );
+	void PruneBuckets( std::chrono::steady_clock::time_point now );
+	void SetAPIURL( Request* request, std::string_view botToken, std::string_view method );
+	void SetDestination( Request* request, std::string_view botToken, std::string_view chatId );
+	std::string_view GetNameOfParseMode( eParseMode ParseMode );
+	MediaInfo GetMediaInfo( eFileType fileType );
 }; // class TelegramNotifications
 
 #endif // !_TELEGRAM_NOTIFICATIONS_H_
\ No newline at end of file
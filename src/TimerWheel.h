@@ -0,0 +1,221 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS slots, each level's
+// slot spanning a whole turn of the level below. A timer is filed by how far
+// away it is and cascades down a level every time the lower wheel wraps, so
+// Schedule and Cancel are O(1) and Advance only touches slots that are due.
+// Per-level occupancy bitmaps give the next deadline without scanning.
+template<typename T>
+class TimerWheel
+{
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr unsigned LEVELS = 4;
+	static constexpr unsigned BITS = 6;
+	static constexpr uint64_t SLOTS = 1ull << BITS; // One bit per slot in Occupied
+	static constexpr uint64_t MASK = SLOTS - 1;
+	static constexpr uint64_t SPAN = 1ull << ( BITS * LEVELS ); // Ticks covered before timers have to wrap around
+public:
+	struct Timer
+	{
+		Timer* Prev{ nullptr };
+		Timer* Next{ nullptr };
+		uint64_t Tick = 0;
+		unsigned Level = 0;
+		unsigned Slot = 0;
+		T Value{};
+	}; // struct Timer
+private:
+	Timer Heads[LEVELS][SLOTS]; // Circular list sentinels, insertion order is kept
+	uint64_t Occupied[LEVELS] = {};
+	Timer* Free{ nullptr }; // Recycled timers, chained through Next
+	Clock::duration Resolution;
+	Clock::time_point Origin;
+	uint64_t Current = 0; // First tick not processed yet
+	size_t Count = 0;
+public:
+	explicit TimerWheel( Clock::duration resolution ) : Resolution( resolution ), Origin( Clock::now() ) {
+		for ( auto& level : Heads )
+			for ( Timer& head : level )
+				head.Prev = head.Next = &head;
+	}
+	~TimerWheel() {
+		for ( auto& level : Heads ) {
+			for ( Timer& head : level ) {
+				while ( head.Next != &head ) {
+					Timer* timer = head.Next;
+					head.Next = timer->Next;
+					delete timer;
+				}
+			}
+		}
+		while ( Free ) {
+			Timer* timer = Free;
+			Free = timer->Next;
+			delete timer;
+		}
+	}
+	TimerWheel( const TimerWheel& ) = delete;
+	TimerWheel& operator=( const TimerWheel& ) = delete;
+
+	size_t Size() const { return Count; }
+	bool Empty() const { return Count == 0; }
+
+	// The returned timer stays valid until it fires or is cancelled
+	Timer* Schedule( T value, Clock::time_point when ) {
+		Timer* timer = Free;
+		if ( timer )
+			Free = timer->Next;
+		else
+			timer = new Timer();
+		timer->Value = value;
+		timer->Tick = when > Origin ? ( ( when - Origin ) + Resolution - Clock::duration( 1 ) ) / Resolution : 0; // Round up, never fire early
+		if ( timer->Tick < Current )
+			timer->Tick = Current;
+		Link( timer );
+		++Count;
+		return timer;
+	}
+
+	void Cancel( Timer* timer ) {
+		Unlink( timer );
+		Release( timer );
+		--Count;
+	}
+
+	// Appends every value due at now to due, earliest tick first
+	void Advance( Clock::time_point now, std::vector<T>& due ) {
+		uint64_t target = now > Origin ? ( now - Origin ) / Resolution : 0;
+		while ( Current <= target ) {
+			uint64_t next = Count != 0 ? NextTick() : target + 1;
+			if ( next > target ) {
+				Current = target + 1; // Nothing in between, not even a cascade, needs this time
+				return;
+			}
+			Current = next;
+			if ( ( Current & MASK ) == 0 )
+				Cascade();
+
+			Timer& head = Heads[0][Current & MASK];
+			while ( head.Next != &head ) {
+				Timer* timer = head.Next;
+				Unlink( timer );
+				if ( timer->Tick > Current ) { // Was further out than the wheel spans, go around again
+					Link( timer );
+					continue;
+				}
+				due.push_back( timer->Value );
+				Release( timer );
+				--Count;
+			}
+			++Current;
+		}
+	}
+
+	// When Advance next has work; max() when empty. Exact for the lowest
+	// level, otherwise the moment the earliest timer cascades down.
+	Clock::time_point NextDeadline() const {
+		if ( Count == 0 )
+			return Clock::time_point::max();
+		return Origin + Resolution * NextTick();
+	}
+
+	template<typename F>
+	void ForEach( F&& visit ) {
+		for ( auto& level : Heads )
+			for ( Timer& head : level )
+				for ( Timer* timer = head.Next; timer != &head; timer = timer->Next )
+					visit( timer->Value );
+	}
+private:
+	void Link( Timer* timer ) {
+		uint64_t delta = timer->Tick - Current;
+		uint64_t tick = delta < SPAN ? timer->Tick : Current + SPAN - 1; // Parked at the far edge, relinked when reached
+		unsigned level = 0;
+		while ( level + 1 < LEVELS && ( tick - Current ) >= ( 1ull << ( BITS * ( level + 1 ) ) ) )
+			++level;
+		timer->Level = level;
+		timer->Slot = static_cast<unsigned>( ( tick >> ( BITS * level ) ) & MASK );
+
+		Timer& head = Heads[level][timer->Slot];
+		timer->Prev = head.Prev;
+		timer->Next = &head;
+		head.Prev->Next = timer;
+		head.Prev = timer;
+		Occupied[level] |= 1ull << timer->Slot;
+	}
+
+	void Unlink( Timer* timer ) {
+		timer->Prev->Next = timer->Next;
+		timer->Next->Prev = timer->Prev;
+		Timer& head = Heads[timer->Level][timer->Slot];
+		if ( head.Next == &head )
+			Occupied[timer->Level] &= ~( 1ull << timer->Slot );
+	}
+
+	void Release( Timer* timer ) {
+		timer->Value = T{};
+		timer->Next = Free;
+		Free = timer;
+	}
+
+	// Current just wrapped the lowest wheel: bring down the slots of the levels above that are now due
+	void Cascade() {
+		for ( unsigned level = 1; level < LEVELS; ++level ) {
+			unsigned slot = static_cast<unsigned>( ( Current >> ( BITS * level ) ) & MASK );
+			Timer& head = Heads[level][slot];
+			while ( head.Next != &head ) {
+				Timer* timer = head.Next;
+				Unlink( timer );
+				Link( timer );
+			}
+			if ( slot != 0 )
+				break; // The next level only turns when this one wraps
+		}
+	}
+
+	uint64_t NextTick() const {
+		uint64_t best = UINT64_MAX;
+		for ( unsigned level = 0; level < LEVELS; ++level ) {
+			if ( Occupied[level] == 0 )
+				continue;
+			unsigned shift = BITS * level;
+			unsigned index = static_cast<unsigned>( ( Current >> shift ) & MASK );
+			uint64_t rotated = index == 0 ? Occupied[level] : ( Occupied[level] >> index ) | ( Occupied[level] << ( SLOTS - index ) ); // Bit 0 is the current slot
+			if ( level != 0 && ( Current & ( ( 1ull << shift ) - 1 ) ) != 0 )
+				rotated &= ~1ull; // Already cascaded when Current crossed into it, what it holds is a whole turn away
+			uint64_t ahead = rotated ? CountTrailingZeros( rotated ) : SLOTS;
+			uint64_t tick = level == 0 ? Current + ahead : ( ( Current >> shift ) + ahead ) << shift;
+			if ( tick < best )
+				best = tick;
+		}
+		return best;
+	}
+
+	static unsigned CountTrailingZeros( uint64_t bits ) {
+#if defined( _MSC_VER ) && defined( _M_IX86 )
+		unsigned long index = 0; // No 64-bit scan on x86, take the low half first
+		if ( _BitScanForward( &index, static_cast<unsigned long>( bits ) ) )
+			return static_cast<unsigned>( index );
+		_BitScanForward( &index, static_cast<unsigned long>( bits >> 32 ) );
+		return static_cast<unsigned>( index ) + 32;
+#elif defined( _MSC_VER )
+		unsigned long index = 0;
+		_BitScanForward64( &index, bits );
+		return static_cast<unsigned>( index );
+#else
+		return static_cast<unsigned>( __builtin_ctzll( bits ) );
+#endif
+	}
+}; // class TimerWheel
+
+#endif // !_TIMER_WHEEL_H_
\ No newline at end of file
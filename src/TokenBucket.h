@@ -0,0 +1,52 @@
+#ifndef _TOKEN_BUCKET_H_
+#define _TOKEN_BUCKET_H_
+
+#include <algorithm>
+#include <chrono>
+
+struct TokenBucket
+{
+	using Clock = std::chrono::steady_clock;
+
+	double Rate; // Tokens per second
+	double Burst; // Bucket size
+	double Tokens;
+	Clock::time_point Updated;
+	Clock::time_point BlockedUntil; // Set from a server-side retry_after
+
+	TokenBucket( double rate, double burst, Clock::time_point now ) : Rate( rate ), Burst( burst ), Tokens( burst ), Updated( now ), BlockedUntil( now ) {}
+
+	void Refill( Clock::time_point now ) {
+		if ( now <= Updated )
+			return;
+		Tokens = std::min( Burst, Tokens + std::chrono::duration<double>( now - Updated ).count() * Rate );
+		Updated = now;
+	}
+
+	// Takes a token, borrowing against the refill when there is none: returns how long until it may be used.
+	// Tokens go negative by one per outstanding reservation, so every caller gets its own slot
+	Clock::duration Reserve( Clock::time_point now ) {
+		Refill( now );
+		Tokens -= 1.0;
+		Clock::time_point ready = std::max( Updated, BlockedUntil );
+		if ( Tokens < 0.0 )
+			ready = std::max( ready, Updated + std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( -Tokens / Rate ) ) );
+		return ready > now ? ready - now : Clock::duration::zero();
+	}
+
+	// Server-side retry_after: nothing refills until then, and the reservations made so far are void
+	void Block( Clock::time_point until ) {
+		if ( until <= BlockedUntil )
+			return;
+		BlockedUntil = until;
+		Tokens = 1.0; // One send when the block lifts; the voided requests reserve again once they wake and find the bucket blocked
+		Updated = until;
+	}
+
+	bool Idle( Clock::time_point now ) {
+		Refill( now );
+		return Tokens >= Burst && BlockedUntil <= now;
+	}
+}; // struct TokenBucket
+
+#endif // !_TOKEN_BUCKET_H_
\ No newline at end of file
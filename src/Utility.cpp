@@ -1,28 +1,261 @@
 #include "Utility.h"
-#include <Windows.h>
-
-std::string Utility::win1251ToUTF8( const char* str ) {
-    std::string res;
-    int result_u, result_c;
-    result_u = MultiByteToWideChar( 1251, 0, str, -1, 0, 0 );
-    if ( !result_u ) { return 0; }
-    wchar_t* ures = new wchar_t[result_u];
-    if ( !MultiByteToWideChar( 1251, 0, str, -1, ures, result_u ) ) {
-        delete[] ures;
-        return 0;
-    }
-    result_c = WideCharToMultiByte( 65001, 0, ures, -1, 0, 0, 0, 0 );
-    if ( !result_c ) {
-        delete[] ures;
-        return 0;
-    }
-    char* cres = new char[result_c];
-    if ( !WideCharToMultiByte( 65001, 0, ures, -1, cres, result_c, 0, 0 ) ) {
-        delete[] cres;
-        return 0;
-    }
-    delete[] ures;
-    res.append( cres );
-    delete[] cres;
-    return res;
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ )
+#	define UTILITY_X86 1
+#	include <immintrin.h>
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#		define TARGET_SSE2
+#		define TARGET_AVX2
+#	else
+#		define TARGET_SSE2 __attribute__(( target( "sse2" ) ))
+#		define TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+#	endif
+#endif
+
+namespace {
+	struct Sequence
+	{
+		char Bytes[4];
+		unsigned char Length;
+	}; // struct Sequence
+
+	// UTF-8 encoding of every CP1251 byte above 0x7F. 0x98 is unassigned and
+	// maps to U+0098, the same as MultiByteToWideChar did.
+	constexpr Sequence HighHalf[128] = {
+	{ "\xD0\x82", 2 }, { "\xD0\x83", 2 }, { "\xE2\x80\x9A", 3 }, { "\xD1\x93", 2 }, // 0x80
+	{ "\xE2\x80\x9E", 3 }, { "\xE2\x80\xA6", 3 }, { "\xE2\x80\xA0", 3 }, { "\xE2\x80\xA1", 3 }, // 0x84
+	{ "\xE2\x82\xAC", 3 }, { "\xE2\x80\xB0", 3 }, { "\xD0\x89", 2 }, { "\xE2\x80\xB9", 3 }, // 0x88
+	{ "\xD0\x8A", 2 }, { "\xD0\x8C", 2 }, { "\xD0\x8B", 2 }, { "\xD0\x8F", 2 }, // 0x8C
+	{ "\xD1\x92", 2 }, { "\xE2\x80\x98", 3 }, { "\xE2\x80\x99", 3 }, { "\xE2\x80\x9C", 3 }, // 0x90
+	{ "\xE2\x80\x9D", 3 }, { "\xE2\x80\xA2", 3 }, { "\xE2\x80\x93", 3 }, { "\xE2\x80\x94", 3 }, // 0x94
+	{ "\xC2\x98", 2 }, { "\xE2\x84\xA2", 3 }, { "\xD1\x99", 2 }, { "\xE2\x80\xBA", 3 }, // 0x98
+	{ "\xD1\x9A", 2 }, { "\xD1\x9C", 2 }, { "\xD1\x9B", 2 }, { "\xD1\x9F", 2 }, // 0x9C
+	{ "\xC2\xA0", 2 }, { "\xD0\x8E", 2 }, { "\xD1\x9E", 2 }, { "\xD0\x88", 2 }, // 0xA0
+	{ "\xC2\xA4", 2 }, { "\xD2\x90", 2 }, { "\xC2\xA6", 2 }, { "\xC2\xA7", 2 }, // 0xA4
+	{ "\xD0\x81", 2 }, { "\xC2\xA9", 2 }, { "\xD0\x84", 2 }, { "\xC2\xAB", 2 }, // 0xA8
+	{ "\xC2\xAC", 2 }, { "\xC2\xAD", 2 }, { "\xC2\xAE", 2 }, { "\xD0\x87", 2 }, // 0xAC
+	{ "\xC2\xB0", 2 }, { "\xC2\xB1", 2 }, { "\xD0\x86", 2 }, { "\xD1\x96", 2 }, // 0xB0
+	{ "\xD2\x91", 2 }, { "\xC2\xB5", 2 }, { "\xC2\xB6", 2 }, { "\xC2\xB7", 2 }, // 0xB4
+	{ "\xD1\x91", 2 }, { "\xE2\x84\x96", 3 }, { "\xD1\x94", 2 }, { "\xC2\xBB", 2 }, // 0xB8
+	{ "\xD1\x98", 2 }, { "\xD0\x85", 2 }, { "\xD1\x95", 2 }, { "\xD1\x97", 2 }, // 0xBC
+	{ "\xD0\x90", 2 }, { "\xD0\x91", 2 }, { "\xD0\x92", 2 }, { "\xD0\x93", 2 }, // 0xC0
+	{ "\xD0\x94", 2 }, { "\xD0\x95", 2 }, { "\xD0\x96", 2 }, { "\xD0\x97", 2 }, // 0xC4
+	{ "\xD0\x98", 2 }, { "\xD0\x99", 2 }, { "\xD0\x9A", 2 }, { "\xD0\x9B", 2 }, // 0xC8
+	{ "\xD0\x9C", 2 }, { "\xD0\x9D", 2 }, { "\xD0\x9E", 2 }, { "\xD0\x9F", 2 }, // 0xCC
+	{ "\xD0\xA0", 2 }, { "\xD0\xA1", 2 }, { "\xD0\xA2", 2 }, { "\xD0\xA3", 2 }, // 0xD0
+	{ "\xD0\xA4", 2 }, { "\xD0\xA5", 2 }, { "\xD0\xA6", 2 }, { "\xD0\xA7", 2 }, // 0xD4
+	{ "\xD0\xA8", 2 }, { "\xD0\xA9", 2 }, { "\xD0\xAA", 2 }, { "\xD0\xAB", 2 }, // 0xD8
+	{ "\xD0\xAC", 2 }, { "\xD0\xAD", 2 }, { "\xD0\xAE", 2 }, { "\xD0\xAF", 2 }, // 0xDC
+	{ "\xD0\xB0", 2 }, { "\xD0\xB1", 2 }, { "\xD0\xB2", 2 }, { "\xD0\xB3", 2 }, // 0xE0
+	{ "\xD0\xB4", 2 }, { "\xD0\xB5", 2 }, { "\xD0\xB6", 2 }, { "\xD0\xB7", 2 }, // 0xE4
+	{ "\xD0\xB8", 2 }, { "\xD0\xB9", 2 }, { "\xD0\xBA", 2 }, { "\xD0\xBB", 2 }, // 0xE8
+	{ "\xD0\xBC", 2 }, { "\xD0\xBD", 2 }, { "\xD0\xBE", 2 }, { "\xD0\xBF", 2 }, // 0xEC
+	{ "\xD1\x80", 2 }, { "\xD1\x81", 2 }, { "\xD1\x82", 2 }, { "\xD1\x83", 2 }, // 0xF0
+	{ "\xD1\x84", 2 }, { "\xD1\x85", 2 }, { "\xD1\x86", 2 }, { "\xD1\x87", 2 }, // 0xF4
+	{ "\xD1\x88", 2 }, { "\xD1\x89", 2 }, { "\xD1\x8A", 2 }, { "\xD1\x8B", 2 }, // 0xF8
+	{ "\xD1\x8C", 2 }, { "\xD1\x8D", 2 }, { "\xD1\x8E", 2 }, { "\xD1\x8F", 2 } // 0xFC
+	};
+
+	// Each scanner returns the length of the pure-ASCII run at the start of [data, end)
+	using AsciiScanner = size_t( * )( const unsigned char* data, const unsigned char* end );
+
+	size_t ScanAsciiScalar( const unsigned char* data, const unsigned char* end ) {
+		const unsigned char* cursor = data;
+		for ( ; end - cursor >= 8; cursor += 8 ) {
+			uint64_t word;
+			std::memcpy( &word, cursor, sizeof( word ) );
+			if ( word & 0x8080808080808080ull )
+				break;
+		}
+		while ( cursor < end && *cursor < 0x80 )
+			++cursor;
+		return static_cast<size_t>( cursor - data );
+	}
+
+#ifdef UTILITY_X86
+	TARGET_SSE2 size_t ScanAsciiSSE2( const unsigned char* data, const unsigned char* end ) {
+		const unsigned char* cursor = data;
+		for ( ; end - cursor >= 16; cursor += 16 ) {
+			int mask = _mm_movemask_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( cursor ) ) );
+			if ( mask ) {
+				unsigned long index;
+#ifdef _MSC_VER
+				_BitScanForward( &index, static_cast<unsigned long>( mask ) );
+#else
+				index = static_cast<unsigned long>( __builtin_ctz( mask ) );
+#endif
+				return static_cast<size_t>( cursor - data ) + index;
+			}
+		}
+		return static_cast<size_t>( cursor - data ) + ScanAsciiScalar( cursor, end );
+	}
+
+	TARGET_AVX2 size_t ScanAsciiAVX2( const unsigned char* data, const unsigned char* end ) {
+		const unsigned char* cursor = data;
+		for ( ; end - cursor >= 32; cursor += 32 ) {
+			int mask = _mm256_movemask_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( cursor ) ) );
+			if ( mask ) {
+				unsigned long index;
+#ifdef _MSC_VER
+				_BitScanForward( &index, static_cast<unsigned long>( mask ) );
+#else
+				index = static_cast<unsigned long>( __builtin_ctz( static_cast<unsigned int>( mask ) ) );
+#endif
+				return static_cast<size_t>( cursor - data ) + index;
+			}
+		}
+		return static_cast<size_t>( cursor - data ) + ScanAsciiSSE2( cursor, end );
+	}
+
+	bool HasAVX2() {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid( info, 0 );
+		if ( info[0] < 7 )
+			return false;
+		__cpuid( info, 1 );
+		bool osxsave = ( info[2] & ( 1 << 27 ) ) != 0;
+		bool avx = ( info[2] & ( 1 << 28 ) ) != 0;
+		if ( !osxsave || !avx || ( _xgetbv( 0 ) & 0x6 ) != 0x6 ) // OS must preserve YMM state
+			return false;
+		__cpuidex( info, 7, 0 );
+		return ( info[1] & ( 1 << 5 ) ) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports( "avx2" );
+#endif
+	}
+#endif
+
+	AsciiScanner SelectScanner() {
+#ifdef UTILITY_X86
+		return HasAVX2() ? &ScanAsciiAVX2 : &ScanAsciiSSE2;
+#else
+		return &ScanAsciiScalar;
+#endif
+	}
+
+	const AsciiScanner ScanAscii = SelectScanner(); // Chosen once, at load time
+}
+
+size_t Utility::win1251ToUTF8( std::string_view str, char* out ) {
+	auto data = reinterpret_cast<const unsigned char*>( str.data() );
+	const unsigned char* end = data + str.size();
+	char* begin = out;
+	while ( data < end ) {
+		if ( *data < 0x80 ) {
+			*out++ = static_cast<char>( *data++ ); // Lone spaces and punctuation between Cyrillic words are not worth a scan
+			if ( data < end && *data < 0x80 ) { // Bulk-copy pure-ASCII runs
+				size_t run = ScanAscii( data, end );
+				std::memcpy( out, data, run );
+				out += run;
+				data += run;
+			}
+		}
+		for ( ; data < end && *data >= 0x80; ++data ) {
+			const Sequence& sequence = HighHalf[*data - 0x80];
+			if ( end - data > 1 ) // out has room for three bytes per input byte left, so a fixed-size copy stays inside
+				std::memcpy( out, sequence.Bytes, sizeof( sequence.Bytes ) );
+			else
+				std::memcpy( out, sequence.Bytes, sequence.Length );
+			out += sequence.Length;
+		}
+	}
+	return static_cast<size_t>( out - begin );
+}
+
+void Utility::win1251ToUTF8( std::string_view str, std::string& out ) {
+	size_t offset = out.size();
+	out.resize( offset + str.size() * MAX_UTF8_RATIO ); // Worst case, trimmed below
+	out.resize( offset + win1251ToUTF8( str, &out[offset] ) );
+}
+
+std::string Utility::win1251ToUTF8( std::string_view str ) {
+	std::string result;
+	win1251ToUTF8( str, result );
+	return result;
+}
+
+namespace {
+	// Index of the value that follows "key": in json, or npos
+	size_t LocateJSONValue( std::string_view json, std::string_view key ) {
+		for ( size_t position = json.find( key ); position != std::string_view::npos; position = json.find( key, position + 1 ) ) {
+			if ( position == 0 || json[position - 1] != '"' || position + key.size() >= json.size() || json[position + key.size()] != '"' )
+				continue;
+			size_t cursor = position + key.size() + 1;
+			while ( cursor < json.size() && ( json[cursor] == ' ' || json[cursor] == ':' ) )
+				++cursor;
+			if ( cursor < json.size() && ( json[cursor] == '-' || ( json[cursor] >= '0' && json[cursor] <= '9' ) ) )
+				return cursor;
+		}
+		return std::string_view::npos;
+	}
+}
+
+long long Utility::FindJSONInteger( std::string_view json, std::string_view key, long long fallback ) {
+	size_t cursor = LocateJSONValue( json, key );
+	if ( cursor == std::string_view::npos )
+		return fallback;
+	bool negative = json[cursor] == '-';
+	if ( negative )
+		++cursor;
+	long long value = 0;
+	for ( ; cursor < json.size() && json[cursor] >= '0' && json[cursor] <= '9'; ++cursor )
+		value = value * 10 + ( json[cursor] - '0' );
+	return negative ? -value : value;
+}
+
+double Utility::FindJSONNumber( std::string_view json, std::string_view key, double fallback ) {
+	size_t cursor = LocateJSONValue( json, key );
+	if ( cursor == std::string_view::npos )
+		return fallback;
+	return ParseNumber( json.substr( cursor ), fallback );
+}
+
+std::string_view Utility::FindHeader( std::string_view headers, std::string_view name ) {
+	while ( !headers.empty() ) {
+		size_t end = headers.find( '\n' );
+		std::string_view line = headers.substr( 0, end );
+		headers = end == std::string_view::npos ? std::string_view() : headers.substr( end + 1 );
+
+		size_t colon = line.find( ':' );
+		if ( colon != name.size() )
+			continue;
+		bool matches = true;
+		for ( size_t i = 0; i < colon && matches; ++i )
+			matches = std::tolower( static_cast<unsigned char>( line[i] ) ) == std::tolower( static_cast<unsigned char>( name[i] ) );
+		if ( !matches )
+			continue;
+
+		std::string_view value = line.substr( colon + 1 );
+		while ( !value.empty() && ( value.front() == ' ' || value.front() == '\t' ) )
+			value.remove_prefix( 1 );
+		while ( !value.empty() && ( value.back() == '\r' || value.back() == ' ' ) )
+			value.remove_suffix( 1 );
+		return value;
+	}
+	return {};
+}
+
+double Utility::ParseNumber( std::string_view text, double fallback ) {
+	char buffer[32];
+	size_t length = std::min( text.size(), sizeof( buffer ) - 1 );
+	std::memcpy( buffer, text.data(), length );
+	buffer[length] = '\0';
+	char* end = nullptr;
+	double value = std::strtod( buffer, &end );
+	return end == buffer ? fallback : value;
+}
+
+size_t Utility::CountCodePoints( std::string_view utf8 ) {
+	size_t count = 0;
+	for ( unsigned char byte : utf8 )
+		count += ( byte & 0xC0 ) != 0x80 ? 1 : 0; // Skip continuation bytes
+	return count;
 }
\ No newline at end of file
@@ -2,11 +2,27 @@
 #define _UTILITY_H_
 
 #include <string>
+#include <string_view>
 
 class Utility
 {
 public:
-	static std::string win1251ToUTF8( const char* str );
+	static constexpr size_t MAX_UTF8_RATIO = 3; // Output bytes per CP1251 byte, at most
+
+	// Writes into out, which must hold str.size() * MAX_UTF8_RATIO bytes; returns the bytes written
+	static size_t win1251ToUTF8( std::string_view str, char* out );
+	// Appends to out
+	static void win1251ToUTF8( std::string_view str, std::string& out );
+	static std::string win1251ToUTF8( std::string_view str );
+
+	// Integer value of the first "key" in a JSON document, without parsing the whole thing
+	static long long FindJSONInteger( std::string_view json, std::string_view key, long long fallback = 0 );
+	static double FindJSONNumber( std::string_view json, std::string_view key, double fallback = 0.0 );
+	// Value of a header in a raw CRLF-separated header block, matched case-insensitively; empty when missing
+	static std::string_view FindHeader( std::string_view headers, std::string_view name );
+	static double ParseNumber( std::string_view text, double fallback = 0.0 );
+
+	static size_t CountCodePoints( std::string_view utf8 );
 }; // class Utility
 
 #endif // !_UTILITY_H_
\ No newline at end of file